@@ -0,0 +1,116 @@
+/*
+Region allocator
+  Carves large chunks out of the heap and hands out memory from them by bumping
+  a pointer. Objects are never freed one by one: the whole arena, or everything
+  allocated since a mark, is released at once. Chunks form a list from newest to
+  oldest, so rewinding to a mark frees the chunks in front of it.
+*/
+
+#include <stdint.h>
+
+#include "arena.h"
+#include "memory_allocator.h"
+
+#define ARENA_ALIGN 16
+#define ARENA_CHUNK_SZ (64 << 10)
+
+typedef struct chunk
+{
+    struct chunk *prev;
+    size_t size;
+    // pad the header so the data behind it stays ARENA_ALIGN aligned
+    size_t pad[2];
+} chunk;
+
+struct arena
+{
+    chunk *head;
+    char *ptr;
+    char *end;
+    size_t chunk_size;
+};
+
+#define CHUNK_DATA(c) ((char *)((c) + 1))
+
+static void release_until(arena *a, chunk *stop)
+{
+    while (a->head != stop)
+    {
+        chunk *prev = a->head->prev;
+        mem_free(a->head);
+        a->head = prev;
+    }
+}
+
+static void *arena_alloc_slow(arena *a, size_t size)
+{
+    // an oversized request gets a chunk of its own
+    size_t cap = size > a->chunk_size ? size : a->chunk_size;
+    if (cap > SIZE_MAX - sizeof(chunk)) return NULL;
+    chunk *c = mem_alloc(sizeof(chunk) + cap);
+    if (!c) return NULL;
+    c->prev = a->head;
+    c->size = cap;
+
+    a->head = c;
+    a->ptr = CHUNK_DATA(c) + size;
+    a->end = CHUNK_DATA(c) + cap;
+    return CHUNK_DATA(c);
+}
+
+arena *arena_create(size_t chunk_size)
+{
+    arena *a = mem_alloc(sizeof(arena));
+    if (!a) return NULL;
+    a->head = NULL;
+    a->chunk_size = chunk_size ? chunk_size : ARENA_CHUNK_SZ;
+
+    // the first chunk is kept until destroy, so the arena is never without one
+    if (!arena_alloc_slow(a, 0))
+    {
+        mem_free(a);
+        return NULL;
+    }
+    return a;
+}
+
+void arena_destroy(arena *a)
+{
+    if (!a) return;
+    release_until(a, NULL);
+    mem_free(a);
+}
+
+void *arena_alloc(arena *a, size_t size)
+{
+    // neither the rounding nor the chunk header may wrap
+    if (size > SIZE_MAX - sizeof(chunk) - ARENA_ALIGN) return NULL;
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    if (size > (size_t)(a->end - a->ptr)) return arena_alloc_slow(a, size);
+
+    void *p = a->ptr;
+    a->ptr += size;
+    return p;
+}
+
+arena_pos arena_mark(arena *a)
+{
+    arena_pos mark = { a->head, a->ptr };
+    return mark;
+}
+
+void arena_reset_to_mark(arena *a, arena_pos mark)
+{
+    release_until(a, mark.chunk);
+    a->ptr = mark.ptr;
+    a->end = CHUNK_DATA(a->head) + a->head->size;
+}
+
+void arena_reset(arena *a)
+{
+    chunk *first = a->head;
+    while (first->prev) first = first->prev;
+    release_until(a, first);
+    a->ptr = CHUNK_DATA(first);
+    a->end = CHUNK_DATA(first) + first->size;
+}
@@ -0,0 +1,36 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct arena arena;
+
+// a position in an arena to rewind to later
+typedef struct arena_pos
+{
+    void *chunk;
+    char *ptr;
+} arena_pos;
+
+// chunk_size is the size of each chunk taken from the heap, 0 for the default
+arena *arena_create(size_t chunk_size);
+void arena_destroy(arena *a);
+
+// bump allocation, aligned like mem_alloc; freed only by a reset or destroy
+void *arena_alloc(arena *a, size_t size);
+
+arena_pos arena_mark(arena *a);
+// release everything allocated since mark was taken
+void arena_reset_to_mark(arena *a, arena_pos mark);
+// release everything, keeping the first chunk for reuse
+void arena_reset(arena *a);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,210 @@
+/*
+malloc interposition
+  Built as libmem_preload.so, this replaces the C library's malloc family with
+  the default heap so unmodified programs run on the allocator:
+
+    LD_PRELOAD=./libmem_preload.so some_program
+
+  It defines the functions glibc documents as enough to replace its malloc:
+  malloc, free, calloc, realloc, aligned_alloc, posix_memalign, memalign,
+  valloc, pvalloc and malloc_usable_size. Everything else in the C library,
+  operator new included, allocates through these.
+
+  The heap is set up by the first call, in threaded mode, over a reservation of
+  MEM_PRELOAD_MAX_SIZE bytes (64 GiB of address space by default, committed as
+  it is used). Calls that arrive while that is under way, whether recursively
+  from the setup itself or from other threads, are served from a static
+  bootstrap buffer that is never reused; freeing such a block is a no-op.
+
+  The heap's own atfork handlers keep fork() safe. The library is built with
+  initial-exec TLS, so reaching the thread cache never goes through
+  __tls_get_addr, which may itself call malloc.
+*/
+
+#include <errno.h>
+#include <malloc.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "memory_allocator.h"
+
+#define BOOTSTRAP_SZ (256 << 10)
+#define DEFAULT_MAX_SIZE ((size_t)64 << 30)
+
+enum { HEAP_UNINIT, HEAP_INITIALIZING, HEAP_READY };
+
+static _Atomic int heap_state;
+
+static _Alignas(64) uint8_t bootstrap[BOOTSTRAP_SZ];
+static _Atomic size_t bootstrap_used;
+
+static int is_bootstrap(const void *ptr)
+{
+    return (const uint8_t *)ptr >= bootstrap && (const uint8_t *)ptr < bootstrap + BOOTSTRAP_SZ;
+}
+
+// bump allocation, each block preceded by its size
+static void *bootstrap_alloc(size_t size, size_t alignment)
+{
+    if (alignment < 16) alignment = 16;
+    if (size > BOOTSTRAP_SZ || alignment > BOOTSTRAP_SZ) return NULL;
+
+    size_t used = atomic_load_explicit(&bootstrap_used, memory_order_relaxed);
+    size_t start, end;
+    do
+    {
+        start = (used + sizeof(size_t) + alignment - 1) & ~(alignment - 1);
+        end = start + size;
+        if (end > BOOTSTRAP_SZ) return NULL;
+    } while (!atomic_compare_exchange_weak(&bootstrap_used, &used, end));
+
+    memcpy(bootstrap + start - sizeof(size_t), &size, sizeof(size));
+    return bootstrap + start;
+}
+
+static size_t bootstrap_size(const void *ptr)
+{
+    size_t size;
+    memcpy(&size, (const uint8_t *)ptr - sizeof(size_t), sizeof(size));
+    return size;
+}
+
+// 1 once the heap can be used, 0 while some call is still setting it up
+static int heap_ready(void)
+{
+    int state = atomic_load_explicit(&heap_state, memory_order_acquire);
+    if (state == HEAP_READY) return 1;
+
+    int expected = HEAP_UNINIT;
+    if (state != HEAP_UNINIT || !atomic_compare_exchange_strong(&heap_state, &expected, HEAP_INITIALIZING))
+        return 0;
+
+    // neither getenv nor strtoull allocate
+    const char *env = getenv("MEM_PRELOAD_MAX_SIZE");
+    size_t max_size = env ? strtoull(env, NULL, 0) : 0;
+    mem_config cfg = { .threaded = 1, .max_size = max_size ? max_size : DEFAULT_MAX_SIZE };
+    mem_init_config(&cfg);
+
+    atomic_store_explicit(&heap_state, HEAP_READY, memory_order_release);
+    return 1;
+}
+
+static void *alloc_aligned(size_t size, size_t alignment)
+{
+    void *ptr = heap_ready() ? mem_alloc_aligned(size, alignment) : bootstrap_alloc(size, alignment);
+    if (!ptr) errno = ENOMEM;
+    return ptr;
+}
+
+void *malloc(size_t size)
+{
+    void *ptr = heap_ready() ? mem_alloc(size) : bootstrap_alloc(size, 0);
+    if (!ptr) errno = ENOMEM;
+    return ptr;
+}
+
+void free(void *ptr)
+{
+    if (!ptr || is_bootstrap(ptr)) return;
+
+    // free must leave errno alone, even if trimming the heap fails
+    int saved = errno;
+    mem_free(ptr);
+    errno = saved;
+}
+
+void *calloc(size_t count, size_t size)
+{
+    size_t total;
+    if (__builtin_mul_overflow(count, size, &total))
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+    void *ptr = malloc(total);
+    if (ptr) memset(ptr, 0, total);
+    return ptr;
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    if (!ptr) return malloc(size);
+    if (is_bootstrap(ptr))
+    {
+        size_t old_size = bootstrap_size(ptr);
+        void *moved = malloc(size);
+        if (moved) memcpy(moved, ptr, old_size < size ? old_size : size);
+        return moved;
+    }
+    if (!size)
+    {
+        free(ptr);
+        return NULL;
+    }
+
+    void *moved = mem_realloc(ptr, size);
+    if (!moved) errno = ENOMEM;
+    return moved;
+}
+
+int posix_memalign(void **out, size_t alignment, size_t size)
+{
+    if (!alignment || alignment % sizeof(void *) || (alignment & (alignment - 1))) return EINVAL;
+
+    int saved = errno;
+    void *ptr = alloc_aligned(size, alignment);
+    errno = saved;
+    if (!ptr) return ENOMEM;
+    *out = ptr;
+    return 0;
+}
+
+void *aligned_alloc(size_t alignment, size_t size)
+{
+    if (!alignment || (alignment & (alignment - 1)))
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+    return alloc_aligned(size, alignment);
+}
+
+void *memalign(size_t alignment, size_t size)
+{
+    // like glibc, round an alignment that is not a power of two up to one
+    if (alignment & (alignment - 1))
+    {
+        if (alignment > SIZE_MAX / 2)
+        {
+            errno = EINVAL;
+            return NULL;
+        }
+        alignment = (size_t)1 << (64 - __builtin_clzll(alignment));
+    }
+    return alloc_aligned(size, alignment ? alignment : 1);
+}
+
+void *valloc(size_t size)
+{
+    return memalign(sysconf(_SC_PAGESIZE), size);
+}
+
+void *pvalloc(size_t size)
+{
+    size_t page = sysconf(_SC_PAGESIZE);
+    if (size > SIZE_MAX - page)
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+    return memalign(page, (size + page - 1) & ~(page - 1));
+}
+
+size_t malloc_usable_size(void *ptr)
+{
+    if (is_bootstrap(ptr)) return bootstrap_size(ptr);
+    return mem_usable_size(ptr);
+}
@@ -0,0 +1,513 @@
+/*
+Allocation trace replay
+  Replays an allocation trace against mem_alloc/mem_free and against the system
+  malloc, then reports time per operation, peak footprint and how live memory,
+  footprint and fragmentation develop over the run. Traces come from
+  mem_trace_start or from the synthetic generators below.
+
+  Trace format, one event per line. Ids are opaque tokens (recorded traces use
+  addresses) and only need to be unique among live blocks:
+    a <id> <size> [alignment]   allocate
+    r <old id> <new id> <size>  reallocate
+    f <id>                      free
+
+  usage:
+    mem_replay gen <producer-consumer|bursty|mixed> <events> [seed] > trace
+    mem_replay run <trace> [segregated|first-fit|next-fit|best-fit|buddy] [samples]
+
+  Footprint and fragmentation of mem_alloc need a MEM_STATS build, malloc
+  footprint comes from mallinfo2.
+*/
+
+#include <inttypes.h>
+#include <malloc.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "memory_allocator.h"
+
+typedef struct event
+{
+    char op;
+    uint32_t slot;
+    size_t size;
+    size_t align;
+} event;
+
+typedef struct trace
+{
+    event *events;
+    size_t count;
+    size_t slots;
+    size_t peak_live;
+} trace;
+
+typedef struct sample
+{
+    size_t live;
+    size_t footprint;
+    double fragmentation;
+} sample;
+
+typedef struct replay_ops
+{
+    const char *name;
+    void *(*alloc)(size_t size);
+    void *(*alloc_aligned)(size_t size, size_t alignment);
+    void *(*realloc)(void *ptr, size_t size);
+    void (*free)(void *ptr);
+    void (*reset)(void);
+    void (*measure)(sample *out);
+} replay_ops;
+
+/* ---- id map: trace ids to dense slots, open addressing ---- */
+
+typedef struct id_map
+{
+    uint64_t *keys;
+    uint32_t *slots;
+    size_t mask;
+} id_map;
+
+// entries bounds the number of ids ever inserted; the table is kept at most
+// half full so probes stay short
+static void id_map_init(id_map *m, size_t entries)
+{
+    size_t cap = 16;
+    while (cap < entries * 2) cap <<= 1;
+    m->keys = calloc(cap, sizeof(uint64_t));
+    m->slots = calloc(cap, sizeof(uint32_t));
+    m->mask = cap - 1;
+}
+
+// entry for id, or the empty entry where it would go
+static size_t id_map_probe(const id_map *m, uint64_t id)
+{
+    // key 0 marks an empty entry, so ids are stored off by one
+    uint64_t key = id + 1;
+    size_t i = (key * 0x9E3779B97F4A7C15ull) & m->mask;
+    while (m->keys[i] && m->keys[i] != key) i = (i + 1) & m->mask;
+    return i;
+}
+
+// slot of a known id, NULL for one never inserted
+static uint32_t *id_map_lookup(id_map *m, uint64_t id)
+{
+    size_t i = id_map_probe(m, id);
+    return m->keys[i] ? &m->slots[i] : NULL;
+}
+
+static uint32_t *id_map_insert(id_map *m, uint64_t id)
+{
+    size_t i = id_map_probe(m, id);
+    m->keys[i] = id + 1;
+    return &m->slots[i];
+}
+
+/* ---- trace loading ---- */
+
+static int load_trace(const char *path, trace *t)
+{
+    FILE *in = fopen(path, "r");
+    if (!in) return -1;
+
+    size_t lines = 0;
+    char line[256];
+    while (fgets(line, sizeof(line), in)) lines++;
+    rewind(in);
+
+    t->events = malloc((lines + 1) * sizeof(event));
+    t->count = 0;
+    t->slots = 0;
+    t->peak_live = 0;
+
+    // track live bytes per slot to find the peak
+    size_t *sizes = calloc(lines + 1, sizeof(size_t));
+    size_t live = 0;
+
+    // only 'a' lines and realloc targets insert, at most one id per line
+    id_map map;
+    id_map_init(&map, lines);
+    // a slot of 0 in the map means freed, slots are stored off by one
+    while (fgets(line, sizeof(line), in))
+    {
+        char op;
+        unsigned long long id, id2;
+        size_t size, align = 0;
+        event *e = &t->events[t->count];
+
+        if (sscanf(line, " %c", &op) != 1) continue;
+        if (op == 'a' && sscanf(line, " a %llx %zu %zu", &id, &size, &align) >= 2)
+        {
+            *id_map_insert(&map, id) = ++t->slots;
+            e->slot = t->slots - 1;
+            sizes[e->slot] = size;
+            live += size;
+        }
+        else if (op == 'r' && sscanf(line, " r %llx %llx %zu", &id, &id2, &size) == 3)
+        {
+            uint32_t *slot = id_map_lookup(&map, id);
+            if (!slot || !*slot) continue;
+            e->slot = *slot - 1;
+            *slot = 0;
+            *id_map_insert(&map, id2) = e->slot + 1;
+            live += size - sizes[e->slot];
+            sizes[e->slot] = size;
+        }
+        else if (op == 'f' && sscanf(line, " f %llx", &id) == 1)
+        {
+            uint32_t *slot = id_map_lookup(&map, id);
+            if (!slot || !*slot) continue;
+            e->slot = *slot - 1;
+            *slot = 0;
+            live -= sizes[e->slot];
+            size = 0;
+        }
+        else continue;
+
+        e->op = op;
+        e->size = size;
+        e->align = align;
+        t->count++;
+        if (live > t->peak_live) t->peak_live = live;
+    }
+
+    free(map.keys);
+    free(map.slots);
+    free(sizes);
+    fclose(in);
+    return 0;
+}
+
+/* ---- allocators under test ---- */
+
+static mem_config replay_config;
+
+static void mem_reset(void)
+{
+    mem_init_config(&replay_config);
+}
+
+static void mem_measure(sample *out)
+{
+    mem_stats stats;
+    mem_get_stats(&stats);
+    out->footprint = stats.committed;
+    out->fragmentation = stats.fragmentation;
+}
+
+static void *malloc_aligned(size_t size, size_t alignment)
+{
+    void *ptr;
+    return posix_memalign(&ptr, alignment, size) ? NULL : ptr;
+}
+
+static void malloc_reset(void)
+{
+    malloc_trim(0);
+}
+
+static void malloc_measure(sample *out)
+{
+    struct mallinfo2 info = mallinfo2();
+    out->footprint = info.arena + info.hblkhd;
+    // malloc does not expose its largest free chunk
+    out->fragmentation = -1;
+}
+
+static const replay_ops mem_ops = {
+    "mem_alloc", mem_alloc, mem_alloc_aligned, mem_realloc, mem_free, mem_reset, mem_measure
+};
+
+static const replay_ops malloc_ops = {
+    "malloc", malloc, malloc_aligned, realloc, free, malloc_reset, malloc_measure
+};
+
+/* ---- replay ---- */
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// run the whole trace; with samples set, measure every `every` events
+static double replay(const trace *t, const replay_ops *ops, sample *samples, size_t every,
+                     size_t *peak_footprint)
+{
+    void **ptrs = calloc(t->slots, sizeof(void *));
+    size_t *sizes = samples ? calloc(t->slots, sizeof(size_t)) : NULL;
+    size_t live = 0, n = 0;
+
+    ops->reset();
+    double start = now_ns();
+    for (size_t i = 0; i < t->count; i++)
+    {
+        const event *e = &t->events[i];
+        void **ptr = &ptrs[e->slot];
+
+        switch (e->op)
+        {
+        case 'a':
+            *ptr = e->align ? ops->alloc_aligned(e->size, e->align) : ops->alloc(e->size);
+            // touch the block like a real caller would
+            if (*ptr && e->size) *(volatile char *)*ptr = 1;
+            break;
+        case 'r':
+            if (*ptr) *ptr = ops->realloc(*ptr, e->size);
+            break;
+        case 'f':
+            ops->free(*ptr);
+            *ptr = NULL;
+            break;
+        }
+
+        if (!samples) continue;
+        if (e->op != 'f' && !*ptr) fprintf(stderr, "%s: allocation of %zu bytes failed\n", ops->name, e->size);
+        live += e->size - sizes[e->slot];
+        sizes[e->slot] = e->size;
+        if (i % every == 0)
+        {
+            sample *s = &samples[n++];
+            ops->measure(s);
+            s->live = live;
+            if (s->footprint > *peak_footprint) *peak_footprint = s->footprint;
+        }
+    }
+    double elapsed = now_ns() - start;
+
+    for (size_t i = 0; i < t->slots; i++)
+    {
+        if (ptrs[i]) ops->free(ptrs[i]);
+    }
+    free(ptrs);
+    free(sizes);
+    return elapsed;
+}
+
+static const char *policy_names[] = {
+    [MEM_POLICY_SEGREGATED] = "segregated",
+    [MEM_POLICY_FIRST_FIT] = "first-fit",
+    [MEM_POLICY_NEXT_FIT] = "next-fit",
+    [MEM_POLICY_BEST_FIT] = "best-fit",
+    [MEM_POLICY_BUDDY] = "buddy",
+};
+
+static int run(int argc, char **argv)
+{
+    trace t;
+    if (load_trace(argv[2], &t))
+    {
+        perror(argv[2]);
+        return 1;
+    }
+    if (!t.count)
+    {
+        fprintf(stderr, "%s: no events\n", argv[2]);
+        return 1;
+    }
+
+    replay_config.policy = MEM_POLICY_SEGREGATED;
+    if (argc > 3)
+    {
+        size_t n = sizeof(policy_names) / sizeof(policy_names[0]);
+        while (n-- && strcmp(policy_names[n], argv[3]));
+        if (n == (size_t)-1)
+        {
+            fprintf(stderr, "unknown policy %s\n", argv[3]);
+            return 1;
+        }
+        replay_config.policy = n;
+    }
+    size_t nsamples = argc > 4 ? strtoul(argv[4], NULL, 10) : 20;
+    if (!nsamples) nsamples = 1;
+    size_t every = (t.count + nsamples - 1) / nsamples;
+
+    // leave plenty of room over the peak so placement, not capacity, is measured
+    replay_config.max_size = 1 << 30;
+    while (replay_config.max_size < t.peak_live * 4) replay_config.max_size <<= 1;
+
+    const replay_ops *ops[] = { &mem_ops, &malloc_ops };
+    sample *samples[2];
+    size_t peak[2] = { 0, 0 };
+    double ns[2];
+
+    printf("trace: %s, %zu events, peak live %zu bytes, policy %s\n\n",
+           argv[2], t.count, t.peak_live, policy_names[replay_config.policy]);
+    for (int i = 0; i < 2; i++)
+    {
+        ns[i] = replay(&t, ops[i], NULL, 0, NULL) / t.count;
+        samples[i] = calloc(nsamples + 1, sizeof(sample));
+        replay(&t, ops[i], samples[i], every, &peak[i]);
+    }
+
+    mem_stats stats;
+    mem_get_stats(&stats);
+    if (stats.peak_committed > peak[0]) peak[0] = stats.peak_committed;
+    if (!peak[0]) printf("note: built without MEM_STATS, mem_alloc footprint is not available\n\n");
+
+    printf("%-10s %10s %16s %12s\n", "allocator", "ns/op", "peak footprint", "peak/live");
+    for (int i = 0; i < 2; i++)
+    {
+        printf("%-10s %10.1f %16zu %12.2f\n", ops[i]->name, ns[i], peak[i], (double)peak[i] / t.peak_live);
+    }
+
+    printf("\n%10s %14s %16s %14s %16s\n", "event", "live", "mem footprint", "mem frag", "malloc footprint");
+    for (size_t n = 0; n * every < t.count; n++)
+    {
+        printf("%10zu %14zu %16zu %14.3f %16zu\n", n * every, samples[0][n].live,
+               samples[0][n].footprint, samples[0][n].fragmentation, samples[1][n].footprint);
+    }
+
+    free(samples[0]);
+    free(samples[1]);
+    free(t.events);
+    return 0;
+}
+
+/* ---- synthetic traces ---- */
+
+static uint64_t rng_state;
+
+static uint64_t rng(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+// mostly small sizes with a long tail, like typical object mixes
+static size_t random_size(size_t max)
+{
+    size_t bits = 4 + rng() % 64 % 8;
+    size_t size = 1 + rng() % ((size_t)1 << bits);
+    return size < max ? size : max;
+}
+
+// messages pass through a queue of a few thousand in flight, freed oldest first
+static void gen_producer_consumer(size_t events)
+{
+    size_t depth = 2048, head = 0, tail = 0;
+    uint64_t *queue = malloc(depth * 2 * sizeof(uint64_t));
+    uint64_t next_id = 1;
+
+    for (size_t i = 0; i < events; i++)
+    {
+        size_t in_flight = tail - head;
+        int produce = in_flight < depth / 2 || (in_flight < depth * 2 - 1 && rng() % 2);
+        if (produce)
+        {
+            queue[tail++ % (depth * 2)] = next_id;
+            printf("a %" PRIx64 " %zu\n", next_id++, random_size(4096));
+        } else {
+            printf("f %" PRIx64 "\n", queue[head++ % (depth * 2)]);
+        }
+    }
+    while (head != tail) printf("f %" PRIx64 "\n", queue[head++ % (depth * 2)]);
+    free(queue);
+}
+
+// bursts of allocations, most of which are freed in random order before the next burst
+static void gen_bursty(size_t events)
+{
+    uint64_t *live = malloc(events * sizeof(uint64_t));
+    size_t nlive = 0, emitted = 0;
+    uint64_t next_id = 1;
+
+    while (emitted < events)
+    {
+        size_t burst = 1000 + rng() % 10000;
+        for (size_t i = 0; i < burst && emitted < events; i++, emitted++)
+        {
+            live[nlive++] = next_id;
+            printf("a %" PRIx64 " %zu\n", next_id++, random_size(64 << 10));
+        }
+        size_t keep = nlive / 10;
+        while (nlive > keep && emitted < events)
+        {
+            size_t victim = rng() % nlive;
+            printf("f %" PRIx64 "\n", live[victim]);
+            live[victim] = live[--nlive];
+            emitted++;
+        }
+    }
+    while (nlive) printf("f %" PRIx64 "\n", live[--nlive]);
+    free(live);
+}
+
+// a slowly growing population of long-lived blocks amid many short-lived ones
+static void gen_mixed(size_t events)
+{
+    uint64_t *shorts = malloc(64 * sizeof(uint64_t));
+    uint64_t *longs = malloc(events * sizeof(uint64_t));
+    size_t nshort = 0, nlong = 0;
+    uint64_t next_id = 1;
+
+    for (size_t i = 0; i < events; i++)
+    {
+        uint64_t r = rng() % 100;
+        if (r < 5)
+        {
+            longs[nlong++] = next_id;
+            printf("a %" PRIx64 " %zu\n", next_id++, random_size(1 << 20));
+        }
+        else if (r < 6 && nlong)
+        {
+            size_t victim = rng() % nlong;
+            printf("f %" PRIx64 "\n", longs[victim]);
+            longs[victim] = longs[--nlong];
+        }
+        else if (r < 55 || !nshort)
+        {
+            if (nshort == 64)
+            {
+                printf("f %" PRIx64 "\n", shorts[0]);
+                memmove(shorts, shorts + 1, --nshort * sizeof(uint64_t));
+            }
+            shorts[nshort++] = next_id;
+            printf("a %" PRIx64 " %zu\n", next_id++, random_size(2048));
+        } else {
+            size_t victim = rng() % nshort;
+            printf("f %" PRIx64 "\n", shorts[victim]);
+            shorts[victim] = shorts[--nshort];
+        }
+    }
+    while (nshort) printf("f %" PRIx64 "\n", shorts[--nshort]);
+    while (nlong) printf("f %" PRIx64 "\n", longs[--nlong]);
+    free(shorts);
+    free(longs);
+}
+
+static int gen(int argc, char **argv)
+{
+    size_t events = strtoul(argv[3], NULL, 10);
+    rng_state = argc > 4 ? strtoull(argv[4], NULL, 10) : 1;
+    if (!rng_state) rng_state = 1;
+
+    if (!strcmp(argv[2], "producer-consumer")) gen_producer_consumer(events);
+    else if (!strcmp(argv[2], "bursty")) gen_bursty(events);
+    else if (!strcmp(argv[2], "mixed")) gen_mixed(events);
+    else
+    {
+        fprintf(stderr, "unknown shape %s\n", argv[2]);
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc >= 4 && !strcmp(argv[1], "gen")) return gen(argc, argv);
+    if (argc >= 3 && !strcmp(argv[1], "run")) return run(argc, argv);
+
+    fprintf(stderr,
+            "usage: %s gen <producer-consumer|bursty|mixed> <events> [seed] > trace\n"
+            "       %s run <trace> [segregated|first-fit|next-fit|best-fit|buddy] [samples]\n",
+            argv[0], argv[0]);
+    return 1;
+}
@@ -0,0 +1,201 @@
+/*
+Huge page TLB benchmark
+  Builds the same object graph in a heap on base pages and in one configured
+  for huge pages, then counts dTLB misses with perf_event_open while it is
+  built (allocation) and while a random pointer chase walks it (access).
+
+  The graph is a large number of small nodes linked in random order, with a
+  large buffer allocated every so often in between, as a long-running program
+  would interleave them. On base pages the nodes spread over tens of thousands
+  of 4 KiB pages; on huge pages they also stay clear of the large buffers, so
+  they fit in a few dozen 2 MiB pages.
+
+  usage: mem_tlb_bench [nodes] [steps]
+
+  Counters need perf_event_open permission (kernel.perf_event_paranoid <= 2 is
+  enough for user-space counts) and a PMU, which many VMs do not expose; the
+  timings are printed either way.
+*/
+
+#include <linux/perf_event.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "memory_allocator.h"
+
+#define LARGE_EVERY 4096
+#define LARGE_SZ (512 << 10)
+
+typedef struct node
+{
+    struct node *next;
+    uint64_t payload[3];
+} node;
+
+typedef struct counters
+{
+    int loads;
+    int misses;
+} counters;
+
+typedef struct result
+{
+    double ns;
+    long long loads;
+    long long misses;
+} result;
+
+static int perf_open(uint64_t result_type)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (result_type << 16);
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static void counters_start(counters *c)
+{
+    if (c->loads >= 0) ioctl(c->loads, PERF_EVENT_IOC_RESET, 0), ioctl(c->loads, PERF_EVENT_IOC_ENABLE, 0);
+    if (c->misses >= 0) ioctl(c->misses, PERF_EVENT_IOC_RESET, 0), ioctl(c->misses, PERF_EVENT_IOC_ENABLE, 0);
+}
+
+static long long counter_read(int fd)
+{
+    long long value;
+    if (fd < 0) return -1;
+    ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+    return read(fd, &value, sizeof(value)) == sizeof(value) ? value : -1;
+}
+
+static void counters_stop(counters *c, result *r)
+{
+    r->loads = counter_read(c->loads);
+    r->misses = counter_read(c->misses);
+}
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static uint64_t rng_state = 88172645463325252ull;
+
+static uint64_t rng(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+static void print_result(const char *phase, const result *r, size_t ops)
+{
+    printf("  %-8s %8.1f ns/op", phase, r->ns / ops);
+    if (r->misses >= 0) printf("  %12lld dTLB misses", r->misses);
+    else printf("  %12s dTLB misses", "n/a");
+    if (r->loads > 0 && r->misses >= 0) printf("  %6.3f%% of loads", 100.0 * r->misses / r->loads);
+    printf("\n");
+}
+
+static const char *backing_names[] = {
+    [MEM_BACKING_BASE_PAGES] = "base pages",
+    [MEM_BACKING_HUGETLB] = "hugetlb",
+    [MEM_BACKING_TRANSPARENT] = "transparent huge pages",
+    [MEM_BACKING_CALLER] = "caller memory",
+};
+
+static void run(int huge_pages, size_t nodes, size_t steps, counters *c)
+{
+    size_t nlarge = nodes / LARGE_EVERY + 1;
+    size_t heap_size = nodes * 64 + nlarge * (LARGE_SZ + 4096) + (64 << 20);
+    mem_config cfg = { .huge_pages = huge_pages };
+    heap_t *heap = heap_create_config(NULL, heap_size, &cfg);
+    if (!heap)
+    {
+        fprintf(stderr, "cannot reserve a %zu byte heap\n", heap_size);
+        exit(1);
+    }
+    mem_stats stats;
+    heap_get_stats(heap, &stats);
+    printf("%s heap (%s):\n", huge_pages ? "huge page" : "base page", backing_names[stats.backing]);
+
+    node **order = malloc(nodes * sizeof(node *));
+    void **large = malloc(nlarge * sizeof(void *));
+    size_t n = 0;
+    result alloc, chase;
+
+    counters_start(c);
+    double start = now_ns();
+    for (size_t i = 0; i < nodes; i++)
+    {
+        order[i] = heap_alloc(heap, sizeof(node));
+        order[i]->payload[0] = i;
+        if (i % LARGE_EVERY == 0)
+        {
+            large[n] = heap_alloc(heap, LARGE_SZ);
+            // touch it so it is backed, like a buffer in use would be
+            memset(large[n++], 0, LARGE_SZ);
+        }
+    }
+    alloc.ns = now_ns() - start;
+    counters_stop(c, &alloc);
+
+    // link the nodes into one cycle in random order
+    for (size_t i = nodes - 1; i > 0; i--)
+    {
+        size_t j = rng() % (i + 1);
+        node *tmp = order[i];
+        order[i] = order[j];
+        order[j] = tmp;
+    }
+    for (size_t i = 0; i < nodes; i++) order[i]->next = order[(i + 1) % nodes];
+
+    node *curr = order[0];
+    uint64_t sum = 0;
+    counters_start(c);
+    start = now_ns();
+    for (size_t i = 0; i < steps; i++)
+    {
+        sum += curr->payload[0];
+        curr = curr->next;
+    }
+    chase.ns = now_ns() - start;
+    counters_stop(c, &chase);
+
+    print_result("alloc", &alloc, nodes + n);
+    print_result("chase", &chase, steps);
+    printf("  (checksum %llu)\n\n", (unsigned long long)sum);
+
+    for (size_t i = 0; i < nodes; i++) heap_free(heap, order[i]);
+    for (size_t i = 0; i < n; i++) heap_free(heap, large[i]);
+    free(order);
+    free(large);
+    heap_destroy(heap);
+}
+
+int main(int argc, char **argv)
+{
+    size_t nodes = argc > 1 ? strtoul(argv[1], NULL, 10) : 1 << 20;
+    size_t steps = argc > 2 ? strtoul(argv[2], NULL, 10) : 20 << 20;
+    if (!nodes) nodes = 1;
+
+    counters c = { perf_open(PERF_COUNT_HW_CACHE_RESULT_ACCESS), perf_open(PERF_COUNT_HW_CACHE_RESULT_MISS) };
+    if (c.misses < 0) printf("dTLB counters unavailable, reporting timings only\n\n");
+
+    run(0, nodes, steps, &c);
+    run(1, nodes, steps, &c);
+    return 0;
+}
@@ -1,78 +1,1649 @@
 /*
 Memory Allocator Simulation
-  Simulate a simple memory manager that allocates and frees blocks from a fixed-size memory array. 
-  You might implement first-fit allocation: find the first contiguous free segment of required size and mark it as used. 
+  Simulate a simple memory manager that allocates and frees blocks from a fixed-size memory array.
+  You might implement first-fit allocation: find the first contiguous free segment of required size and mark it as used.
   Also implement freeing of a given block id, coalescing freed segments if needed
+
+  Free blocks are kept in segregated free lists (bins) indexed by size class:
+  exact bins every ALIGNMENT bytes up to SMALL_MAX, then one bin per power of two.
+  A bitmap of non-empty bins lets mem_alloc jump straight to the first bin that
+  can satisfy a request instead of walking every block in the heap.
+
+  Blocks are also doubly linked in address order, so a freed block only has
+  to look at its immediate physical neighbours to coalesce.
+
+  In threaded mode the heap sits behind a mutex and every thread keeps a small
+  cache (tcache) of blocks per small size class. Most allocations and frees hit
+  only the calling thread's cache; it is refilled from and flushed to the shared
+  heap in batches, so the lock is taken once per TCACHE_BATCH operations.
+  A block freed by another thread than the one it came from goes back to its
+  owner through a lock-free stack, which the owner drains on its next
+  allocation, so producer/consumer pairs recycle blocks without the heap lock.
+
+  The heap lives in an address range reserved with mmap but left inaccessible.
+  It is committed CHUNK_SZ at a time as allocations need it, and a large free
+  block at the end of the heap is handed back to the OS with MADV_DONTNEED, so
+  resident memory follows what is actually in use rather than the maximum size.
+
+  A heap configured for huge pages is mapped with MAP_HUGETLB when the hugetlb
+  pool can cover it, and otherwise reserved on a 2 MiB boundary and marked with
+  MADV_HUGEPAGE for transparent huge pages. Either way it commits whole huge
+  pages at a time, and large blocks are taken from the top of a free block so
+  the small, frequently touched ones share as few huge pages (and TLB entries)
+  as possible.
+
+  Headers and payload sizes are multiples of ALIGNMENT, so every payload is
+  aligned for max_align_t. mem_alloc_aligned over-allocates and splits off the
+  space in front of the first suitably aligned payload as a free block.
+
+  With MEM_STATS defined the heap keeps counters for mem_get_stats. They are
+  only touched under the heap lock, and blocks sitting in thread caches count as
+  in use. Without MEM_STATS the STAT() hooks compile away entirely.
+
+  The placement policy is chosen per heap at mem_init_config. Besides the
+  segregated bins there are first-fit and next-fit, which walk the address
+  ordered chain (next-fit from a roving pointer), best-fit, which keeps free
+  blocks in a treap ordered by size, and a binary buddy system. The buddy heap
+  commits a power-of-two region up front and reuses the bins as per-order free
+  lists; blocks there are split and merged with their buddies instead of their
+  physical neighbours. Since pages of the region are only backed once they are
+  written, a buddy heap reports as committed the furthest point into the region
+  any block has reached, not the region itself.
+
+  All of the above lives in a heap_t. The mem_* functions work on a static
+  default heap; heap_create makes further ones, either over caller memory (the
+  heap_t sits at its front and the memory is used as already committed) or
+  over a reservation of their own.
+
+  Blocks allocated through handles may be relocated. Their handle id sits in
+  the header and indexes a table holding the block's current address and pin
+  count. Compaction walks the heap in address order and swaps every hole with
+  the unpinned handle block right above it, memmove-ing the data down, so holes
+  bubble up and merge until they reach the top of the heap. It runs against a
+  time budget and resumes where it stopped, either on request or before the
+  heap grows.
+
+  mem_trace_start makes the public calls log one line per event to a file, in
+  the format mem_replay reads back (see mem_replay.c). Blocks are identified by
+  their address, so a line's id is only unique until that block is freed.
 */
 
-#include <_locale.h>
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <string.h>
 #include <stdio.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <time.h>
+
+#include "memory_allocator.h"
 
 #define MEM_SZ (1 << 30)
+#define CHUNK_SZ (1 << 20)
+#define HUGE_PAGE_SZ (2 << 20)
+// only give memory back once this many commit chunks sit unused past the last block
+#define TRIM_CHUNKS 2
+// on huge page heaps, blocks this large are carved from the top of a free block
+// so the small ones below them stay packed into as few huge pages as possible
+#define HUGE_TAIL_MIN (HUGE_PAGE_SZ / 8)
+
+#ifndef MAP_HUGE_2MB
+#define MAP_HUGE_2MB (21 << MAP_HUGE_SHIFT)
+#endif
+
+#define ALIGNMENT 16
+#define SMALL_MAX 1024
+#define NSMALL (SMALL_MAX / ALIGNMENT)
+// large bins cover [2^k, 2^(k+1)) for k = log2(SMALL_MAX) .. 63
+#define NBINS (NSMALL + 64 - 10)
+#define BITMAP_WORDS ((NBINS + 63) / 64)
+
+// handle ids index a table reserved up front and filled in on demand
+#define MAX_HANDLES (1u << 22)
+
+#define TCACHE_MAX 32
+#define TCACHE_BATCH 16
+// blocks coming back from other threads are ones this thread is likely to
+// allocate again soon, so a drain may fill a class well past TCACHE_MAX
+#define TCACHE_REMOTE_MAX 512
+// thread caches that can take remote frees at the same time; owner 0 never does
+#define MAX_OWNERS 1024
+
+#define TRACE(...) do { if (trace_out) fprintf(trace_out, __VA_ARGS__); } while (0)
+
+#ifdef MEM_STATS
+#define STAT(stmt) do { stmt; } while (0)
+#else
+#define STAT(stmt) do { } while (0)
+#endif
 
 typedef struct block
 {
     size_t size;
-    int free;
+    uint16_t free;
+    // thread cache that last handed the block out, see remote_frees; 0 for a
+    // block that did not come from a cache
+    uint16_t owner;
+    // handle of a relocatable block, 0 for ordinary ones
+    uint32_t handle;
     struct block *next;
+    struct block *prev;
 } block;
 
-static struct
+// marks the header in front of an over-aligned pointer into a buddy block;
+// prev points at the real block and size is what is usable from the pointer
+#define BLOCK_ALIAS 2
+
+_Static_assert(ALIGNMENT >= _Alignof(max_align_t), "payloads must be aligned for any type");
+_Static_assert(sizeof(block) % ALIGNMENT == 0, "headers must keep payloads aligned");
+
+// a free block's payload holds its links in the bin it belongs to
+typedef struct free_links
+{
+    block *next_free;
+    block *prev_free;
+} free_links;
+
+#define MIN_PAYLOAD sizeof(free_links)
+#define LINKS(b) ((free_links *)((b) + 1))
+
+// best-fit keeps free blocks in a treap instead, ordered by size then address
+typedef struct tree_links
+{
+    block *left;
+    block *right;
+} tree_links;
+
+#define TREE(b) ((tree_links *)((b) + 1))
+
+// smallest buddy block: a header plus room for the free links
+#define BUDDY_MIN_ORDER 6
+
+typedef struct tcache
+{
+    block *entries[NSMALL];
+    uint32_t counts[NSMALL];
+    unsigned generation;
+    int registered;
+    uint16_t owner;
+} tcache;
+
+// Blocks freed by a thread other than the one whose cache handed them out are
+// pushed onto that owner's stack without a lock; the owner takes the whole
+// stack at once on its next allocation. The stacks live outside the caches, so
+// a push never touches a thread that is already gone: an owner closes its stack
+// on exit and a closed stack sends frees to the freeing thread's own cache.
+// Every stack starts closed, so a stale owner in a header is always safe
+typedef struct remote_stack
+{
+    _Alignas(64) _Atomic(block *) head;
+} remote_stack;
+
+#define REMOTE_CLOSED ((block *)1)
+
+// a cached block stays in use as far as the heap is concerned; its payload
+// links it into the cache and remembers which cache holds it
+typedef struct tcache_entry
 {
-    uint8_t mem[MEM_SZ];
+    block *next;
+    tcache *key;
+} tcache_entry;
+
+#define ENTRY(b) ((tcache_entry *)((b) + 1))
+
+typedef struct handle_entry
+{
+    block *blk;
+    uint32_t pins;
+    // next unused handle while this one is unused
+    uint32_t next_free;
+} handle_entry;
+
+struct heap
+{
+    uint8_t *mem;
+    size_t reserved;
+    size_t committed;
     block *block_list;
-} allocator;
+    block *last;
+    block *bins[NBINS];
+    uint64_t bitmap[BITMAP_WORDS];
 
-void mem_init()
+    mem_policy policy;
+    // where next-fit resumes its search
+    block *rover;
+    // best-fit treap root
+    block *tree;
+    // order of the whole buddy region
+    size_t buddy_max;
+
+    handle_entry *handles;
+    // handles ever handed out and the head of the unused ones
+    uint32_t handle_count;
+    uint32_t handle_free;
+    // block the next compaction step starts from, NULL to start a new pass
+    block *compact_from;
+    uint64_t compact_budget_ns;
+
+    // the heap reserved mem itself; caller-provided memory is never remapped
+    int owns_mem;
+    // granularity of commits and trims, a whole huge page on huge page heaps
+    size_t chunk;
+    mem_backing backing;
+    // place large blocks at the top of free blocks
+    int tail_large;
+    int threaded;
+    // bumped by every mem_init so caches never hand out blocks of an old heap
+    unsigned generation;
+    pthread_mutex_t lock;
+
+#ifdef MEM_STATS
+    struct
+    {
+        size_t allocs;
+        size_t frees;
+        size_t blocks;
+        size_t free_blocks;
+        size_t free_bytes;
+        size_t peak_bytes;
+        size_t peak_committed;
+        size_t scanned;
+        size_t histogram[MEM_HIST_BUCKETS];
+    } stats;
+#endif
+};
+
+// the heap behind the mem_* functions
+static heap_t default_heap = {
+    .lock = PTHREAD_MUTEX_INITIALIZER
+};
+
+static FILE *trace_out;
+
+static _Thread_local tcache thread_cache;
+static pthread_key_t tcache_key;
+static pthread_once_t tcache_key_once = PTHREAD_ONCE_INIT;
+static remote_stack remote_frees[MAX_OWNERS];
+static uint8_t owners_used[MAX_OWNERS];
+static pthread_mutex_t owners_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t atfork_once = PTHREAD_ONCE_INIT;
+
+static size_t log2_floor(size_t n)
 {
-    allocator.block_list = (block *)(allocator.mem);
-    allocator.block_list->size = MEM_SZ - sizeof(block);
-    allocator.block_list->free = 1;
-    allocator.block_list->next = NULL;
+    return 63 - __builtin_clzll(n);
 }
 
-void *mem_alloc(size_t size)
+static size_t bin_index(size_t size)
 {
-    block *curr = allocator.block_list;
-    while (curr)
+    if (size < SMALL_MAX + ALIGNMENT)
+        return size / ALIGNMENT - 1;
+    return NSMALL + log2_floor(size) - 10;
+}
+
+static void list_insert(heap_t *h, size_t idx, block *blk)
+{
+    free_links *links = LINKS(blk);
+    links->prev_free = NULL;
+    links->next_free = h->bins[idx];
+    if (links->next_free) LINKS(links->next_free)->prev_free = blk;
+    h->bins[idx] = blk;
+    h->bitmap[idx / 64] |= 1ull << (idx % 64);
+}
+
+static void list_remove(heap_t *h, size_t idx, block *blk)
+{
+    free_links *links = LINKS(blk);
+    if (links->prev_free) LINKS(links->prev_free)->next_free = links->next_free;
+    else h->bins[idx] = links->next_free;
+    if (links->next_free) LINKS(links->next_free)->prev_free = links->prev_free;
+    if (!h->bins[idx]) h->bitmap[idx / 64] &= ~(1ull << (idx % 64));
+}
+
+static size_t buddy_order(block *blk)
+{
+    return log2_floor(blk->size + sizeof(block));
+}
+
+static uintptr_t treap_priority(block *blk)
+{
+    uintptr_t x = (uintptr_t)blk;
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdull;
+    x ^= x >> 33;
+    return x;
+}
+
+static int treap_less(block *a, block *b)
+{
+    return a->size < b->size || (a->size == b->size && a < b);
+}
+
+static block *treap_insert(block *root, block *blk)
+{
+    if (!root)
+    {
+        TREE(blk)->left = NULL;
+        TREE(blk)->right = NULL;
+        return blk;
+    }
+    if (treap_less(blk, root))
     {
-        if (curr->free && curr->size >= size)
+        block *left = treap_insert(TREE(root)->left, blk);
+        if (treap_priority(left) > treap_priority(root))
         {
-            if (curr->size >= size + sizeof(block))
-            {
-                block *split = (block *)((uint8_t *)curr + sizeof(block) + size);
-                split->size = curr->size - size - sizeof(block);
-                split->free = 1;
-                split->next = curr->next;
+            TREE(root)->left = TREE(left)->right;
+            TREE(left)->right = root;
+            return left;
+        }
+        TREE(root)->left = left;
+    } else {
+        block *right = treap_insert(TREE(root)->right, blk);
+        if (treap_priority(right) > treap_priority(root))
+        {
+            TREE(root)->right = TREE(right)->left;
+            TREE(right)->left = root;
+            return right;
+        }
+        TREE(root)->right = right;
+    }
+    return root;
+}
 
-                curr->next = split;
-            }
-            curr->free = 0;
-            return (uint8_t *)curr + sizeof(block);
+// join two treaps where every key in a is below every key in b
+static block *treap_join(block *a, block *b)
+{
+    if (!a) return b;
+    if (!b) return a;
+    if (treap_priority(a) > treap_priority(b))
+    {
+        TREE(a)->right = treap_join(TREE(a)->right, b);
+        return a;
+    }
+    TREE(b)->left = treap_join(a, TREE(b)->left);
+    return b;
+}
+
+static block *treap_remove(block *root, block *blk)
+{
+    if (root == blk) return treap_join(TREE(root)->left, TREE(root)->right);
+    if (treap_less(blk, root)) TREE(root)->left = treap_remove(TREE(root)->left, blk);
+    else TREE(root)->right = treap_remove(TREE(root)->right, blk);
+    return root;
+}
+
+// make a free block findable by the heap's placement policy
+static void free_insert(heap_t *h, block *blk)
+{
+    switch (h->policy)
+    {
+    case MEM_POLICY_SEGREGATED:
+        list_insert(h, bin_index(blk->size), blk);
+        break;
+    case MEM_POLICY_BEST_FIT:
+        h->tree = treap_insert(h->tree, blk);
+        break;
+    case MEM_POLICY_BUDDY:
+        list_insert(h, buddy_order(blk), blk);
+        break;
+    default:
+        // first-fit and next-fit find free blocks through the address-ordered chain
+        break;
+    }
+    STAT(h->stats.free_blocks++; h->stats.free_bytes += blk->size);
+}
+
+static void free_remove(heap_t *h, block *blk)
+{
+    switch (h->policy)
+    {
+    case MEM_POLICY_SEGREGATED:
+        list_remove(h, bin_index(blk->size), blk);
+        break;
+    case MEM_POLICY_BEST_FIT:
+        h->tree = treap_remove(h->tree, blk);
+        break;
+    case MEM_POLICY_BUDDY:
+        list_remove(h, buddy_order(blk), blk);
+        break;
+    default:
+        break;
+    }
+    STAT(h->stats.free_blocks--; h->stats.free_bytes -= blk->size);
+}
+
+// first non-empty bin at or after idx, NBINS if there is none
+static size_t next_bin(heap_t *h, size_t idx)
+{
+    for (size_t w = idx / 64; w < BITMAP_WORDS; w++)
+    {
+        uint64_t bits = h->bitmap[w];
+        if (w == idx / 64) bits &= ~0ull << (idx % 64);
+        if (bits) return w * 64 + __builtin_ctzll(bits);
+    }
+    return NBINS;
+}
+
+static block *bin_fit(heap_t *h, size_t size)
+{
+    size_t idx = bin_index(size);
+
+    // a large bin spans a whole power of two, so its blocks may still be too small
+    if (idx >= NSMALL && h->bins[idx])
+    {
+        for (block *curr = h->bins[idx]; curr; curr = LINKS(curr)->next_free)
+        {
+            STAT(h->stats.scanned++);
+            if (curr->size >= size) return curr;
         }
-        curr = curr->next;
+        idx++;
+    }
+
+    // every block in any later bin is big enough
+    STAT(h->stats.scanned++);
+    idx = next_bin(h, idx);
+    return idx < NBINS ? h->bins[idx] : NULL;
+}
+
+// first free block of at least size bytes from `from` up to, not including, `to`
+static block *chain_fit(heap_t *h, block *from, block *to, size_t size)
+{
+    (void)h; // only needed for the scan statistics
+    for (block *curr = from; curr != to; curr = curr->next)
+    {
+        STAT(h->stats.scanned++);
+        if (curr->free && curr->size >= size) return curr;
     }
     return NULL;
 }
 
-void mem_free(void *ptr)
+static block *next_fit(heap_t *h, size_t size)
 {
-    if (!ptr) return;
-    block *blk = ((block *)ptr) - 1;
-    blk->free = 1;
+    block *start = h->rover ? h->rover : h->block_list;
+    block *blk = chain_fit(h, start, NULL, size);
+    if (!blk) blk = chain_fit(h, h->block_list, start, size);
+    if (blk) h->rover = blk;
+    return blk;
+}
 
-    // connect free blocks from the start
-    block *curr = allocator.block_list;
-    while (curr && curr->next)
+// smallest free block of at least size bytes
+static block *best_fit(heap_t *h, size_t size)
+{
+    block *best = NULL;
+    for (block *curr = h->tree; curr;)
     {
-        if (curr->free && curr->next->free)
+        STAT(h->stats.scanned++);
+        if (curr->size >= size)
         {
-            curr->size += curr->next->size + sizeof(block);
-            curr->next = curr->next->next;
+            best = curr;
+            curr = TREE(curr)->left;
         } else {
-            curr = curr->next;
+            curr = TREE(curr)->right;
+        }
+    }
+    return best;
+}
+
+static block *find_fit(heap_t *h, size_t size)
+{
+    switch (h->policy)
+    {
+    case MEM_POLICY_FIRST_FIT:
+        return chain_fit(h, h->block_list, NULL, size);
+    case MEM_POLICY_NEXT_FIT:
+        return next_fit(h, size);
+    case MEM_POLICY_BEST_FIT:
+        return best_fit(h, size);
+    default:
+        return bin_fit(h, size);
+    }
+}
+
+static void heap_lock(heap_t *h)
+{
+    if (h->threaded) pthread_mutex_lock(&h->lock);
+}
+
+static void heap_unlock(heap_t *h)
+{
+    if (h->threaded) pthread_mutex_unlock(&h->lock);
+}
+
+// commit at least need more bytes at the end of the heap, growing the last
+// block if it is free or appending a new free block otherwise
+static int heap_extend(heap_t *h, size_t need)
+{
+    block *last = h->last;
+    size_t n = (need + h->chunk - 1) & ~(h->chunk - 1);
+    if (n > h->reserved - h->committed) n = h->reserved - h->committed;
+    if (n < need) return 0;
+
+    uint8_t *top = h->mem + h->committed;
+    if (h->owns_mem && mprotect(top, n, PROT_READ | PROT_WRITE)) return 0;
+    h->committed += n;
+    STAT(if (h->committed > h->stats.peak_committed) h->stats.peak_committed = h->committed);
+
+    if (last && last->free)
+    {
+        free_remove(h, last);
+        last->size += n;
+        free_insert(h, last);
+        return 1;
+    }
+
+    block *blk = (block *)top;
+    STAT(h->stats.blocks++);
+    blk->size = n - sizeof(block);
+    blk->free = 1;
+    blk->handle = 0;
+    blk->owner = 0;
+    blk->next = NULL;
+    blk->prev = last;
+    if (last) last->next = blk;
+    else h->block_list = blk;
+    h->last = blk;
+    free_insert(h, blk);
+    return 1;
+}
+
+// commit enough memory past the end of the heap to fit a block of size bytes
+static int heap_grow(heap_t *h, size_t size)
+{
+    block *last = h->last;
+    if (last && last->free) return heap_extend(h, size - last->size);
+    return heap_extend(h, size + sizeof(block));
+}
+
+// decommit whole chunks past the start of a free last block
+static void heap_trim(heap_t *h, block *blk)
+{
+    // hugetlb pages stay reserved for the mapping anyway, trimming gains nothing
+    if (blk != h->last || !h->owns_mem || h->backing == MEM_BACKING_HUGETLB) return;
+
+    size_t used = (uint8_t *)(blk + 1) + MIN_PAYLOAD - h->mem;
+    size_t keep = (used + h->chunk - 1) & ~(h->chunk - 1);
+    if (h->committed - keep < TRIM_CHUNKS * h->chunk) return;
+
+    size_t n = h->committed - keep;
+    madvise(h->mem + keep, n, MADV_DONTNEED);
+    mprotect(h->mem + keep, n, PROT_NONE);
+    h->committed = keep;
+
+    free_remove(h, blk);
+    blk->size -= n;
+    free_insert(h, blk);
+}
+
+static size_t request_size(size_t size)
+{
+    size = (size + ALIGNMENT - 1) & ~(size_t)(ALIGNMENT - 1);
+    return size < MIN_PAYLOAD ? MIN_PAYLOAD : size;
+}
+
+#ifdef MEM_STATS
+static size_t largest_free(heap_t *h)
+{
+    size_t largest = 0;
+    switch (h->policy)
+    {
+    case MEM_POLICY_SEGREGATED:
+    case MEM_POLICY_BUDDY:
+        // the largest free block sits in the highest non-empty bin or order
+        for (size_t idx = NBINS; idx-- > 0;)
+        {
+            if (!h->bins[idx]) continue;
+            for (block *curr = h->bins[idx]; curr; curr = LINKS(curr)->next_free)
+            {
+                if (curr->size > largest) largest = curr->size;
+            }
+            break;
+        }
+        break;
+    case MEM_POLICY_BEST_FIT:
+        for (block *curr = h->tree; curr; curr = TREE(curr)->right)
+        {
+            largest = curr->size;
+        }
+        break;
+    default:
+        for (block *curr = h->block_list; curr; curr = curr->next)
+        {
+            if (curr->free && curr->size > largest) largest = curr->size;
+        }
+        break;
+    }
+    return largest;
+}
+
+static size_t stats_live_bytes(heap_t *h)
+{
+    return h->committed - h->stats.free_bytes - h->stats.blocks * sizeof(block);
+}
+
+static void stats_update_peak(heap_t *h)
+{
+    size_t live = stats_live_bytes(h);
+    if (live > h->stats.peak_bytes) h->stats.peak_bytes = live;
+}
+#endif
+
+// carve a new in-use block out of blk, starting size bytes into its payload
+static block *split_at(heap_t *h, block *blk, size_t size)
+{
+    block *split = (block *)((uint8_t *)(blk + 1) + size);
+    STAT(h->stats.blocks++);
+    split->size = blk->size - size - sizeof(block);
+    split->free = 0;
+    split->handle = 0;
+    split->owner = 0;
+    split->next = blk->next;
+    split->prev = blk;
+    if (split->next) split->next->prev = split;
+
+    blk->size = size;
+    blk->next = split;
+    if (h->last == blk) h->last = split;
+    return split;
+}
+
+// absorb blk->next into blk; both must already be out of the bins
+static void merge_next(heap_t *h, block *blk)
+{
+    block *next = blk->next;
+    STAT(h->stats.blocks--);
+    blk->size += next->size + sizeof(block);
+    blk->next = next->next;
+    if (blk->next) blk->next->prev = blk;
+    if (h->last == next) h->last = blk;
+    if (h->rover == next) h->rover = blk;
+    if (h->compact_from == next) h->compact_from = blk;
+}
+
+static void buddy_init(heap_t *h)
+{
+    size_t order = log2_floor(h->reserved);
+    size_t region = (size_t)1 << order;
+    if (h->owns_mem && mprotect(h->mem, region, PROT_READ | PROT_WRITE)) return;
+    h->committed = region;
+    h->buddy_max = order;
+
+    block *blk = (block *)h->mem;
+    STAT(h->stats.blocks++);
+    blk->size = region - sizeof(block);
+    blk->free = 1;
+    blk->handle = 0;
+    blk->owner = 0;
+    blk->next = NULL;
+    blk->prev = NULL;
+    h->block_list = blk;
+    free_insert(h, blk);
+}
+
+static size_t buddy_order_for(size_t size)
+{
+    size_t need = size + sizeof(block);
+    if (need <= (size_t)1 << BUDDY_MIN_ORDER) return BUDDY_MIN_ORDER;
+    return log2_floor(need - 1) + 1;
+}
+
+// split the upper halves off blk until it is down to the given order
+static void buddy_split(heap_t *h, block *blk, size_t order)
+{
+    for (size_t k = buddy_order(blk); k > order;)
+    {
+        k--;
+        block *half = (block *)((uint8_t *)blk + ((size_t)1 << k));
+        STAT(h->stats.blocks++);
+        half->size = ((size_t)1 << k) - sizeof(block);
+        half->free = 1;
+        half->handle = 0;
+        half->owner = 0;
+        free_insert(h, half);
+        blk->size = ((size_t)1 << k) - sizeof(block);
+    }
+}
+
+static block *buddy_alloc(heap_t *h, size_t size)
+{
+    size_t order = buddy_order_for(size);
+    size_t k = next_bin(h, order);
+    if (k > h->buddy_max) return NULL;
+
+    block *blk = h->bins[k];
+    free_remove(h, blk);
+    blk->free = 0;
+    buddy_split(h, blk, order);
+    // the region is never trimmed, so how far blocks reached is all it has touched
+    STAT(size_t reached = (uint8_t *)blk + ((size_t)1 << order) - h->mem;
+         if (reached > h->stats.peak_committed) h->stats.peak_committed = reached);
+    return blk;
+}
+
+static void buddy_free(heap_t *h, block *blk)
+{
+    size_t k = buddy_order(blk);
+    while (k < h->buddy_max)
+    {
+        size_t offset = (uint8_t *)blk - h->mem;
+        block *buddy = (block *)(h->mem + (offset ^ ((size_t)1 << k)));
+        if (buddy->free != 1 || buddy_order(buddy) != k) break;
+
+        free_remove(h, buddy);
+        STAT(h->stats.blocks--);
+        if (buddy < blk) blk = buddy;
+        k++;
+    }
+    blk->size = ((size_t)1 << k) - sizeof(block);
+    blk->free = 1;
+    free_insert(h, blk);
+}
+
+static void free_block(heap_t *h, block *blk)
+{
+    if (h->policy == MEM_POLICY_BUDDY)
+    {
+        buddy_free(h, blk);
+        return;
+    }
+    blk->free = 1;
+
+    // coalesce with the physical neighbours only
+    if (blk->next && blk->next->free)
+    {
+        free_remove(h, blk->next);
+        merge_next(h, blk);
+    }
+    if (blk->prev && blk->prev->free)
+    {
+        blk = blk->prev;
+        free_remove(h, blk);
+        merge_next(h, blk);
+    }
+    free_insert(h, blk);
+    heap_trim(h, blk);
+}
+
+// give everything past the first size bytes of an in-use block back to the heap
+static void shrink_block(heap_t *h, block *blk, size_t size)
+{
+    if (blk->size >= size + sizeof(block) + MIN_PAYLOAD)
+    {
+        free_block(h, split_at(h, blk, size));
+    }
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int movable(heap_t *h, block *blk)
+{
+    return blk && !blk->free && blk->handle && !h->handles[blk->handle].pins;
+}
+
+// swap the free block hole with the relocatable block right above it, moving
+// that block's data down; returns the hole, now merged with whatever is above
+static block *compact_step(heap_t *h, block *hole)
+{
+    block *moved = hole->next;
+    block *next = moved->next;
+    size_t hole_size = hole->size;
+    size_t size = moved->size;
+    uint32_t handle = moved->handle;
+
+    free_remove(h, hole);
+    memmove(hole + 1, moved + 1, size);
+    hole->size = size;
+    hole->free = 0;
+    hole->handle = handle;
+    hole->owner = 0;
+    h->handles[handle].blk = hole;
+    if (h->rover == moved) h->rover = hole;
+
+    block *rest = (block *)((uint8_t *)(hole + 1) + size);
+    rest->size = hole_size;
+    rest->free = 1;
+    rest->handle = 0;
+    rest->owner = 0;
+    rest->prev = hole;
+    rest->next = next;
+    hole->next = rest;
+    if (next) next->prev = rest;
+    if (h->last == moved) h->last = rest;
+
+    if (next && next->free)
+    {
+        free_remove(h, next);
+        merge_next(h, rest);
+    }
+    free_insert(h, rest);
+    return rest;
+}
+
+// slide unpinned relocatable blocks down into the holes below them until the
+// end of the heap or the deadline; 1 once a whole pass has been made
+static int compact(heap_t *h, uint64_t budget_ns)
+{
+    // buddy blocks are tied to their positions
+    if (h->policy == MEM_POLICY_BUDDY || !h->handles) return 1;
+
+    uint64_t start = now_ns();
+    uint64_t deadline = budget_ns > UINT64_MAX - start ? UINT64_MAX : start + budget_ns;
+    block *curr = h->compact_from ? h->compact_from : h->block_list;
+    // the resume point may itself be moved below, it is only kept between calls
+    h->compact_from = NULL;
+    while (curr)
+    {
+        if (now_ns() >= deadline)
+        {
+            h->compact_from = curr;
+            return 0;
         }
+        if (curr->free && movable(h, curr->next)) curr = compact_step(h, curr);
+        else curr = curr->next;
+    }
+
+    // whatever free space reached the top can go back to the OS
+    if (h->last && h->last->free) heap_trim(h, h->last);
+    return 1;
+}
+
+static block *alloc_block(heap_t *h, size_t size)
+{
+    STAT(h->stats.allocs++;
+         h->stats.histogram[log2_floor(size) < MEM_HIST_BUCKETS ? log2_floor(size) : MEM_HIST_BUCKETS - 1]++);
+
+    if (h->policy == MEM_POLICY_BUDDY)
+    {
+        block *blk = buddy_alloc(h, size);
+        STAT(stats_update_peak(h));
+        return blk;
+    }
+
+    block *curr = find_fit(h, size);
+    if (!curr && h->compact_budget_ns)
+    {
+        // holes freed between relocatable blocks may add up to enough space
+        compact(h, h->compact_budget_ns);
+        curr = find_fit(h, size);
+    }
+    if (!curr)
+    {
+        if (!heap_grow(h, size)) return NULL;
+        curr = find_fit(h, size);
+    }
+
+    free_remove(h, curr);
+    curr->free = 0;
+    if (h->tail_large && size >= HUGE_TAIL_MIN && curr->size >= size + sizeof(block) + MIN_PAYLOAD)
+    {
+        block *blk = split_at(h, curr, curr->size - size - sizeof(block));
+        curr->free = 1;
+        free_insert(h, curr);
+        curr = blk;
+    } else {
+        shrink_block(h, curr, size);
     }
-}
\ No newline at end of file
+    STAT(stats_update_peak(h));
+    return curr;
+}
+
+// a block the caller is done with, as opposed to internal splits
+static void release_block(heap_t *h, block *blk)
+{
+    STAT(h->stats.frees++);
+    free_block(h, blk);
+}
+
+// resize an in-use block without moving it, 0 if that is not possible
+static int resize_block(heap_t *h, block *blk, size_t size)
+{
+    if (h->policy == MEM_POLICY_BUDDY)
+    {
+        // a buddy block can only give back its upper halves
+        if (blk->size < size) return 0;
+        buddy_split(h, blk, buddy_order_for(size));
+        return 1;
+    }
+
+    if (blk->size < size)
+    {
+        block *next = blk->next;
+        size_t avail = blk->size;
+        if (next && next->free) avail += sizeof(block) + next->size;
+
+        if (avail < size)
+        {
+            // only the end of the heap can be stretched by committing more memory
+            block *tail = next && next->free ? next : blk;
+            if (tail != h->last || !heap_extend(h, size - avail)) return 0;
+            next = blk->next;
+        }
+        free_remove(h, next);
+        merge_next(h, blk);
+    }
+    shrink_block(h, blk, size);
+    STAT(stats_update_peak(h));
+    return 1;
+}
+
+// buddy blocks start on power-of-two boundaries with the header in front of the
+// payload, so an over-aligned payload gets an alias header pointing back instead
+static void *buddy_alloc_aligned(heap_t *h, size_t size, size_t alignment)
+{
+    block *blk = alloc_block(h, size + alignment + sizeof(block));
+    if (!blk) return NULL;
+
+    uintptr_t payload = (uintptr_t)(blk + 1);
+    if (!(payload & (alignment - 1))) return blk + 1;
+
+    uintptr_t aligned = (payload + sizeof(block) + alignment - 1) & ~(uintptr_t)(alignment - 1);
+    block *alias = (block *)aligned - 1;
+    alias->size = payload + blk->size - aligned;
+    alias->free = BLOCK_ALIAS;
+    alias->handle = 0;
+    alias->owner = 0;
+    alias->next = NULL;
+    alias->prev = blk;
+    return (void *)aligned;
+}
+
+static void *alloc_block_aligned(heap_t *h, size_t size, size_t alignment)
+{
+    if (h->policy == MEM_POLICY_BUDDY) return buddy_alloc_aligned(h, size, alignment);
+
+    // enough slack to move the payload up to the boundary and leave a free block in front
+    block *blk = alloc_block(h, size + alignment + sizeof(block) + MIN_PAYLOAD);
+    if (!blk) return NULL;
+
+    uintptr_t payload = (uintptr_t)(blk + 1);
+    if (payload & (alignment - 1))
+    {
+        uintptr_t aligned = (payload + sizeof(block) + MIN_PAYLOAD + alignment - 1) & ~(uintptr_t)(alignment - 1);
+        block *lead = blk;
+        blk = split_at(h, lead, aligned - sizeof(block) - payload);
+        free_block(h, lead);
+    }
+    shrink_block(h, blk, size);
+    return blk + 1;
+}
+
+static void tcache_push(tcache *tc, size_t idx, block *blk)
+{
+    ENTRY(blk)->next = tc->entries[idx];
+    ENTRY(blk)->key = tc;
+    tc->entries[idx] = blk;
+    tc->counts[idx]++;
+}
+
+static block *tcache_pop(tcache *tc, size_t idx)
+{
+    block *blk = tc->entries[idx];
+    tc->entries[idx] = ENTRY(blk)->next;
+    ENTRY(blk)->key = NULL;
+    tc->counts[idx]--;
+    return blk;
+}
+
+// hand up to n cached blocks of one class back to the heap
+static void tcache_release(tcache *tc, size_t idx, uint32_t n)
+{
+    heap_t *h = &default_heap;
+    heap_lock(h);
+    while (n-- && tc->entries[idx])
+    {
+        release_block(h, tcache_pop(tc, idx));
+    }
+    heap_unlock(h);
+}
+
+// move a list of remotely freed blocks into the cache, anything that does not
+// fit goes back to the heap under a single lock
+static void tcache_absorb(tcache *tc, block *blk)
+{
+    block *excess = NULL;
+    while (blk)
+    {
+        block *next = ENTRY(blk)->next;
+        size_t idx = bin_index(blk->size);
+        if (tc->counts[idx] < TCACHE_REMOTE_MAX)
+        {
+            tcache_push(tc, idx, blk);
+        } else {
+            ENTRY(blk)->next = excess;
+            excess = blk;
+        }
+        blk = next;
+    }
+    if (!excess) return;
+
+    heap_t *h = &default_heap;
+    heap_lock(h);
+    while (excess)
+    {
+        block *next = ENTRY(excess)->next;
+        release_block(h, excess);
+        excess = next;
+    }
+    heap_unlock(h);
+}
+
+static void tcache_drain(tcache *tc)
+{
+    remote_stack *stack = &remote_frees[tc->owner];
+    if (!tc->owner || !atomic_load_explicit(&stack->head, memory_order_relaxed)) return;
+    tcache_absorb(tc, atomic_exchange_explicit(&stack->head, NULL, memory_order_acquire));
+}
+
+static void tcache_flush(tcache *tc)
+{
+    tcache_drain(tc);
+    for (size_t idx = 0; idx < NSMALL; idx++)
+    {
+        tcache_release(tc, idx, tc->counts[idx]);
+    }
+}
+
+static void tcache_destroy(void *arg)
+{
+    tcache *tc = arg;
+    int current = tc->generation == default_heap.generation;
+
+    if (tc->owner)
+    {
+        // close the stack first so nothing can be pushed after the final drain
+        block *pending = atomic_exchange_explicit(&remote_frees[tc->owner].head, REMOTE_CLOSED,
+                                                  memory_order_acquire);
+        if (current) tcache_absorb(tc, pending);
+        pthread_mutex_lock(&owners_lock);
+        owners_used[tc->owner] = 0;
+        pthread_mutex_unlock(&owners_lock);
+        tc->owner = 0;
+    }
+    if (current) tcache_flush(tc);
+}
+
+static void tcache_key_create(void)
+{
+    pthread_key_create(&tcache_key, tcache_destroy);
+    for (size_t i = 0; i < MAX_OWNERS; i++)
+    {
+        atomic_init(&remote_frees[i].head, REMOTE_CLOSED);
+    }
+}
+
+// claim a free remote stack for the calling thread's cache, 0 if none is left
+static uint16_t owner_claim(void)
+{
+    uint16_t owner = 0;
+    pthread_mutex_lock(&owners_lock);
+    for (uint16_t i = 1; i < MAX_OWNERS; i++)
+    {
+        if (owners_used[i]) continue;
+        owners_used[i] = 1;
+        atomic_store_explicit(&remote_frees[i].head, NULL, memory_order_relaxed);
+        owner = i;
+        break;
+    }
+    pthread_mutex_unlock(&owners_lock);
+    return owner;
+}
+
+static tcache *tcache_get(void)
+{
+    tcache *tc = &thread_cache;
+    if (!tc->registered)
+    {
+        // the key's destructor flushes the cache when the thread exits
+        pthread_once(&tcache_key_once, tcache_key_create);
+        pthread_setspecific(tcache_key, tc);
+        tc->owner = owner_claim();
+        tc->registered = 1;
+    }
+    if (tc->generation != default_heap.generation)
+    {
+        memset(tc->entries, 0, sizeof(tc->entries));
+        memset(tc->counts, 0, sizeof(tc->counts));
+        // remote frees of the old heap are just as stale
+        if (tc->owner) atomic_store_explicit(&remote_frees[tc->owner].head, NULL, memory_order_relaxed);
+        tc->generation = default_heap.generation;
+    }
+    return tc;
+}
+
+static void *tcache_alloc(size_t size)
+{
+    heap_t *h = &default_heap;
+    tcache *tc = tcache_get();
+    size_t idx = bin_index(size);
+
+    tcache_drain(tc);
+    if (!tc->entries[idx])
+    {
+        heap_lock(h);
+        for (int i = 0; i < TCACHE_BATCH; i++)
+        {
+            block *blk = alloc_block(h, size);
+            if (!blk) break;
+            tcache_push(tc, idx, blk);
+        }
+        heap_unlock(h);
+        if (!tc->entries[idx]) return NULL;
+    }
+
+    block *blk = tcache_pop(tc, idx);
+    blk->owner = tc->owner;
+    return blk + 1;
+}
+
+// hand blk to the cache that allocated it, 0 if that cache is gone
+static int remote_free(uint16_t owner, block *blk)
+{
+    remote_stack *stack = &remote_frees[owner];
+    ENTRY(blk)->key = NULL;
+    block *head = atomic_load_explicit(&stack->head, memory_order_relaxed);
+    do
+    {
+        if (head == REMOTE_CLOSED) return 0;
+        ENTRY(blk)->next = head;
+    } while (!atomic_compare_exchange_weak_explicit(&stack->head, &head, blk,
+                                                    memory_order_release, memory_order_relaxed));
+    return 1;
+}
+
+static void tcache_free(block *blk)
+{
+    tcache *tc = tcache_get();
+    size_t idx = bin_index(blk->size);
+
+    // an owner out of range cannot come from a cache, keep the block here
+    if (blk->owner != tc->owner && blk->owner < MAX_OWNERS && remote_free(blk->owner, blk)) return;
+
+    // a matching key is only a hint, confirm it is really a double free
+    if (ENTRY(blk)->key == tc)
+    {
+        for (block *curr = tc->entries[idx]; curr; curr = ENTRY(curr)->next)
+        {
+            if (curr == blk) return;
+        }
+    }
+
+    if (tc->counts[idx] >= TCACHE_MAX) tcache_release(tc, idx, TCACHE_BATCH);
+    tcache_push(tc, idx, blk);
+}
+
+// thread caches only ever serve the default heap: it lives as long as the
+// process, while an instance heap may be destroyed with blocks still cached
+static int heap_cached(heap_t *h)
+{
+    return h == &default_heap && h->threaded;
+}
+
+// reserve size bytes of address space for h, nothing committed yet
+static int heap_reserve(heap_t *h, size_t size, int huge_pages)
+{
+    h->backing = MEM_BACKING_BASE_PAGES;
+    if (huge_pages)
+    {
+        // without MAP_NORESERVE the mapping fails up front, rather than faulting
+        // later, when the hugetlb pool cannot cover the whole heap
+        void *mem = mmap(NULL, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_HUGE_2MB, -1, 0);
+        if (mem != MAP_FAILED)
+        {
+            h->mem = mem;
+            h->backing = MEM_BACKING_HUGETLB;
+            return 0;
+        }
+    }
+
+    // over-reserve so a huge page aligned range of size bytes can be cut out
+    size_t slack = huge_pages ? HUGE_PAGE_SZ : 0;
+    uint8_t *raw = mmap(NULL, size + slack, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (raw == MAP_FAILED) return -1;
+    h->mem = raw;
+    if (!huge_pages) return 0;
+
+    h->mem = (uint8_t *)(((uintptr_t)raw + HUGE_PAGE_SZ - 1) & ~(uintptr_t)(HUGE_PAGE_SZ - 1));
+    if (h->mem > raw) munmap(raw, h->mem - raw);
+    munmap(h->mem + size, raw + slack - h->mem);
+    // madvise mode THP only backs ranges that asked for it
+    if (!madvise(h->mem, size, MADV_HUGEPAGE)) h->backing = MEM_BACKING_TRANSPARENT;
+    return 0;
+}
+
+static void handles_release(heap_t *h)
+{
+    if (h->handles) munmap(h->handles, MAX_HANDLES * sizeof(handle_entry));
+    h->handles = NULL;
+    h->handle_count = 0;
+    h->handle_free = 0;
+}
+
+// reset h to an empty heap over [mem, mem + size); a NULL mem reserves size
+// bytes of fresh address space instead
+static int heap_setup(heap_t *h, void *mem, size_t size, const mem_config *cfg)
+{
+    h->threaded = cfg ? cfg->threaded : 0;
+    h->policy = cfg ? cfg->policy : MEM_POLICY_SEGREGATED;
+    h->generation++;
+
+    memset(h->bins, 0, sizeof(h->bins));
+    memset(h->bitmap, 0, sizeof(h->bitmap));
+    h->block_list = NULL;
+    h->last = NULL;
+    h->rover = NULL;
+    h->tree = NULL;
+    handles_release(h);
+    h->compact_from = NULL;
+    h->compact_budget_ns = cfg ? cfg->compact_budget_ns : 0;
+    h->committed = 0;
+    STAT(memset(&h->stats, 0, sizeof(h->stats)));
+
+    int huge_pages = cfg ? cfg->huge_pages : 0;
+    h->tail_large = huge_pages && h->policy != MEM_POLICY_BUDDY;
+    h->chunk = huge_pages ? HUGE_PAGE_SZ : CHUNK_SZ;
+
+    h->owns_mem = !mem;
+    if (mem)
+    {
+        h->mem = mem;
+        h->reserved = size;
+        h->backing = MEM_BACKING_CALLER;
+    } else {
+        // nothing is committed until the first allocation
+        h->reserved = (size + h->chunk - 1) & ~(h->chunk - 1);
+        if (heap_reserve(h, h->reserved, huge_pages))
+        {
+            h->mem = NULL;
+            h->reserved = 0;
+            return -1;
+        }
+    }
+
+    // the buddy system needs its whole power-of-two region from the start
+    if (h->policy == MEM_POLICY_BUDDY) buddy_init(h);
+    return 0;
+}
+
+// a child forked while another thread held the heap lock, or was claiming or
+// releasing a remote stack, would never see that lock released
+static void heap_fork_prepare(void)
+{
+    pthread_mutex_lock(&owners_lock);
+    heap_lock(&default_heap);
+}
+
+static void heap_fork_release(void)
+{
+    heap_unlock(&default_heap);
+    pthread_mutex_unlock(&owners_lock);
+}
+
+static void heap_atfork_register(void)
+{
+    pthread_atfork(heap_fork_prepare, heap_fork_release, heap_fork_release);
+}
+
+void mem_init_config(const mem_config *cfg)
+{
+    heap_t *h = &default_heap;
+    if (cfg && cfg->threaded) pthread_once(&atfork_once, heap_atfork_register);
+
+    // start over with a fresh reservation
+    if (h->mem) munmap(h->mem, h->reserved);
+    h->mem = NULL;
+    heap_setup(h, NULL, cfg && cfg->max_size ? cfg->max_size : MEM_SZ, cfg);
+}
+
+void mem_init()
+{
+    mem_init_config(NULL);
+}
+
+heap_t *heap_create(void *mem, size_t size)
+{
+    return heap_create_config(mem, size, NULL);
+}
+
+heap_t *heap_create_config(void *mem, size_t size, const mem_config *cfg)
+{
+    heap_t *h;
+
+    if (mem)
+    {
+        // the heap keeps its own state at the front of the caller's memory
+        uintptr_t start = ((uintptr_t)mem + _Alignof(heap_t) - 1) & ~(uintptr_t)(_Alignof(heap_t) - 1);
+        uintptr_t base = (start + sizeof(heap_t) + ALIGNMENT - 1) & ~(uintptr_t)(ALIGNMENT - 1);
+        uintptr_t end = (uintptr_t)mem + size;
+        if (end < base || end - base < (size_t)1 << BUDDY_MIN_ORDER) return NULL;
+
+        h = (heap_t *)start;
+        mem = (void *)base;
+        size = end - base;
+    } else {
+        h = mmap(NULL, sizeof(heap_t), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (h == MAP_FAILED) return NULL;
+        if (!size) size = cfg && cfg->max_size ? cfg->max_size : MEM_SZ;
+    }
+
+    memset(h, 0, sizeof(*h));
+    pthread_mutex_init(&h->lock, NULL);
+    if (heap_setup(h, mem, size, cfg))
+    {
+        munmap(h, sizeof(heap_t));
+        return NULL;
+    }
+    return h;
+}
+
+void heap_destroy(heap_t *h)
+{
+    if (!h || h == &default_heap) return;
+    pthread_mutex_destroy(&h->lock);
+    handles_release(h);
+    if (!h->owns_mem) return;
+
+    munmap(h->mem, h->reserved);
+    munmap(h, sizeof(heap_t));
+}
+
+void *heap_alloc(heap_t *h, size_t size)
+{
+    if (size > h->reserved) return NULL;
+    size = request_size(size);
+
+    if (heap_cached(h) && size <= SMALL_MAX) return tcache_alloc(size);
+
+    heap_lock(h);
+    block *blk = alloc_block(h, size);
+    heap_unlock(h);
+    return blk ? (uint8_t *)blk + sizeof(block) : NULL;
+}
+
+static void free_ptr(heap_t *h, void *ptr)
+{
+    block *blk = ((block *)ptr) - 1;
+    if (blk->free == BLOCK_ALIAS) blk = blk->prev;
+    if (blk->free) return;
+
+    if (heap_cached(h) && blk->size <= SMALL_MAX)
+    {
+        tcache_free(blk);
+        return;
+    }
+
+    heap_lock(h);
+    release_block(h, blk);
+    heap_unlock(h);
+}
+
+void *heap_alloc_aligned(heap_t *h, size_t size, size_t alignment)
+{
+    if (!alignment || (alignment & (alignment - 1))) return NULL;
+    if (alignment <= ALIGNMENT) return heap_alloc(h, size);
+    if (size > h->reserved || alignment > h->reserved) return NULL;
+
+    heap_lock(h);
+    void *ptr = alloc_block_aligned(h, request_size(size), alignment);
+    heap_unlock(h);
+    return ptr;
+}
+
+// the old block is handed back through *old rather than freed, so callers
+// can log the move before the block becomes reusable
+static void *realloc_ptr(heap_t *h, void *ptr, size_t size, void **old)
+{
+    *old = NULL;
+    if (size > h->reserved) return NULL;
+
+    block *blk = ((block *)ptr) - 1;
+    size_t old_size = blk->size;
+    size_t new_size = request_size(size);
+
+    // an over-aligned buddy pointer does not start its block, so it always moves
+    int in_place = 0;
+    if (blk->free != BLOCK_ALIAS)
+    {
+        heap_lock(h);
+        in_place = resize_block(h, blk, new_size);
+        heap_unlock(h);
+    }
+    if (in_place) return ptr;
+
+    void *moved = heap_alloc(h, new_size);
+    if (!moved) return NULL;
+    memcpy(moved, ptr, old_size < new_size ? old_size : new_size);
+    *old = ptr;
+    return moved;
+}
+
+void *heap_realloc(heap_t *h, void *ptr, size_t size)
+{
+    if (!ptr) return heap_alloc(h, size);
+    if (!size)
+    {
+        heap_free(h, ptr);
+        return NULL;
+    }
+
+    void *old;
+    void *moved = realloc_ptr(h, ptr, size, &old);
+    if (old) free_ptr(h, old);
+    return moved;
+}
+
+void heap_free(heap_t *h, void *ptr)
+{
+    if (!ptr) return;
+    free_ptr(h, ptr);
+}
+
+void heap_get_stats(heap_t *h, mem_stats *out)
+{
+    memset(out, 0, sizeof(*out));
+    out->backing = h->backing;
+#ifdef MEM_STATS
+    heap_lock(h);
+    out->allocs = h->stats.allocs;
+    out->frees = h->stats.frees;
+    out->bytes_live = stats_live_bytes(h);
+    out->peak_bytes = h->stats.peak_bytes;
+    out->committed = h->policy == MEM_POLICY_BUDDY ? h->stats.peak_committed : h->committed;
+    out->peak_committed = h->stats.peak_committed;
+    out->free_blocks = h->stats.free_blocks;
+    out->free_bytes = h->stats.free_bytes;
+    memcpy(out->histogram, h->stats.histogram, sizeof(out->histogram));
+
+    out->largest_free = largest_free(h);
+    heap_unlock(h);
+
+    if (out->free_bytes)
+        out->fragmentation = 1.0 - (double)out->largest_free / (double)out->free_bytes;
+    if (out->allocs)
+        out->avg_scanned = (double)h->stats.scanned / (double)out->allocs;
+#endif
+}
+
+mem_handle heap_handle_alloc(heap_t *h, size_t size)
+{
+    if (size > h->reserved) return 0;
+
+    heap_lock(h);
+    if (!h->handles)
+    {
+        // untouched entries cost nothing, so reserve the whole table at once
+        void *table = mmap(NULL, MAX_HANDLES * sizeof(handle_entry), PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (table == MAP_FAILED)
+        {
+            heap_unlock(h);
+            return 0;
+        }
+        h->handles = table;
+    }
+
+    mem_handle handle = h->handle_free;
+    if (!handle && h->handle_count + 1 >= MAX_HANDLES)
+    {
+        heap_unlock(h);
+        return 0;
+    }
+
+    block *blk = alloc_block(h, request_size(size));
+    if (blk)
+    {
+        // handle 0 means none, so the table starts at 1
+        if (handle) h->handle_free = h->handles[handle].next_free;
+        else handle = ++h->handle_count;
+        h->handles[handle] = (handle_entry){ .blk = blk };
+        blk->handle = handle;
+    } else {
+        handle = 0;
+    }
+    heap_unlock(h);
+    return handle;
+}
+
+void heap_handle_free(heap_t *h, mem_handle handle)
+{
+    if (!handle) return;
+
+    heap_lock(h);
+    handle_entry *entry = &h->handles[handle];
+    entry->blk->handle = 0;
+    release_block(h, entry->blk);
+    *entry = (handle_entry){ .next_free = h->handle_free };
+    h->handle_free = handle;
+    heap_unlock(h);
+}
+
+void *heap_handle_lock(heap_t *h, mem_handle handle)
+{
+    if (!handle) return NULL;
+
+    heap_lock(h);
+    handle_entry *entry = &h->handles[handle];
+    entry->pins++;
+    void *ptr = entry->blk + 1;
+    heap_unlock(h);
+    return ptr;
+}
+
+void heap_handle_unlock(heap_t *h, mem_handle handle)
+{
+    if (!handle) return;
+
+    heap_lock(h);
+    h->handles[handle].pins--;
+    heap_unlock(h);
+}
+
+int heap_compact(heap_t *h, uint64_t budget_ns)
+{
+    heap_lock(h);
+    int done = compact(h, budget_ns);
+    heap_unlock(h);
+    return done;
+}
+
+void *mem_alloc(size_t size)
+{
+    void *ptr = heap_alloc(&default_heap, size);
+    if (ptr) TRACE("a %" PRIxPTR " %zu\n", (uintptr_t)ptr, size);
+    return ptr;
+}
+
+void *mem_alloc_aligned(size_t size, size_t alignment)
+{
+    void *ptr = heap_alloc_aligned(&default_heap, size, alignment);
+    if (ptr) TRACE("a %" PRIxPTR " %zu %zu\n", (uintptr_t)ptr, size, alignment);
+    return ptr;
+}
+
+void *mem_realloc(void *ptr, size_t size)
+{
+    if (!ptr) return mem_alloc(size);
+    if (!size)
+    {
+        mem_free(ptr);
+        return NULL;
+    }
+
+    void *old;
+    void *moved = realloc_ptr(&default_heap, ptr, size, &old);
+    if (!moved) return NULL;
+
+    // logged before the old block is released so its reuse is traced after it
+    TRACE("r %" PRIxPTR " %" PRIxPTR " %zu\n", (uintptr_t)ptr, (uintptr_t)moved, size);
+    if (old) free_ptr(&default_heap, old);
+    return moved;
+}
+
+void mem_free(void *ptr)
+{
+    if (!ptr) return;
+    TRACE("f %" PRIxPTR "\n", (uintptr_t)ptr);
+    free_ptr(&default_heap, ptr);
+}
+
+size_t mem_usable_size(const void *ptr)
+{
+    if (!ptr) return 0;
+    const block *blk = ((const block *)ptr) - 1;
+    return blk->size;
+}
+
+mem_handle mem_handle_alloc(size_t size)
+{
+    return heap_handle_alloc(&default_heap, size);
+}
+
+void mem_handle_free(mem_handle handle)
+{
+    heap_handle_free(&default_heap, handle);
+}
+
+void *mem_handle_lock(mem_handle handle)
+{
+    return heap_handle_lock(&default_heap, handle);
+}
+
+void mem_handle_unlock(mem_handle handle)
+{
+    heap_handle_unlock(&default_heap, handle);
+}
+
+int mem_compact(uint64_t budget_ns)
+{
+    return heap_compact(&default_heap, budget_ns);
+}
+
+void mem_trace_start(FILE *out)
+{
+    heap_lock(&default_heap);
+    trace_out = out;
+    heap_unlock(&default_heap);
+}
+
+void mem_trace_stop(void)
+{
+    heap_lock(&default_heap);
+    if (trace_out) fflush(trace_out);
+    trace_out = NULL;
+    heap_unlock(&default_heap);
+}
+
+void mem_thread_flush(void)
+{
+    if (!default_heap.threaded) return;
+    tcache_flush(tcache_get());
+}
+
+void mem_get_stats(mem_stats *out)
+{
+    heap_get_stats(&default_heap, out);
+}
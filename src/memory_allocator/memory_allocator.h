@@ -0,0 +1,157 @@
+#ifndef MEMORY_ALLOCATOR_H
+#define MEMORY_ALLOCATOR_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum mem_policy
+{
+    // size-class free lists, close to O(1) placement
+    MEM_POLICY_SEGREGATED,
+    // lowest-addressed free block that fits
+    MEM_POLICY_FIRST_FIT,
+    // first fit, resuming from where the previous search stopped
+    MEM_POLICY_NEXT_FIT,
+    // smallest free block that fits, from a size-ordered tree
+    MEM_POLICY_BEST_FIT,
+    // binary buddy system over a power-of-two region, committed up front
+    MEM_POLICY_BUDDY,
+} mem_policy;
+
+typedef enum mem_backing
+{
+    MEM_BACKING_BASE_PAGES,
+    // 2 MiB pages from the hugetlb pool
+    MEM_BACKING_HUGETLB,
+    // 2 MiB aligned and advised for transparent huge pages, which the kernel
+    // may or may not actually provide
+    MEM_BACKING_TRANSPARENT,
+    // memory handed to heap_create, backed however the caller mapped it
+    MEM_BACKING_CALLER,
+} mem_backing;
+
+typedef struct mem_config
+{
+    // serialize the heap and give every thread its own cache of small blocks.
+    // The default heap then also holds its lock across fork(), so a child can
+    // allocate even if another thread was inside the allocator at the time
+    int threaded;
+    // upper bound on the heap; address space is reserved up front but only
+    // committed as it is used. 0 selects the default of 1 GiB
+    size_t max_size;
+    mem_policy policy;
+    // back the heap with 2 MiB pages and keep large blocks away from small
+    // ones, cutting TLB misses on large heaps
+    int huge_pages;
+    // when a request does not fit, spend up to this long compacting handle
+    // blocks before growing the heap; 0 leaves compaction to mem_compact
+    uint64_t compact_budget_ns;
+} mem_config;
+
+#define MEM_HIST_BUCKETS 40
+
+// heap counters, only collected when built with MEM_STATS; all zero otherwise.
+// Blocks held in thread caches count as allocated
+typedef struct mem_stats
+{
+    // always filled in
+    mem_backing backing;
+    size_t allocs;
+    size_t frees;
+    size_t bytes_live;
+    size_t peak_bytes;
+    // memory currently committed from the reservation, headers included; for a
+    // buddy heap, how far into its region blocks have ever reached
+    size_t committed;
+    size_t peak_committed;
+    size_t free_blocks;
+    size_t free_bytes;
+    size_t largest_free;
+    // 1 - largest_free / free_bytes: 0 when all free memory is one block
+    double fragmentation;
+    // free blocks examined per allocation
+    double avg_scanned;
+    // allocations by size, bucket i counts sizes in [2^i, 2^(i+1))
+    size_t histogram[MEM_HIST_BUCKETS];
+} mem_stats;
+
+// cfg may be NULL for the defaults: single-threaded, 1 GiB maximum, segregated bins
+void mem_init_config(const mem_config *cfg);
+void mem_init();
+
+// every returned pointer is aligned for max_align_t
+void *mem_alloc(size_t size);
+// alignment must be a power of two, e.g. 64 for a cache line or 4096 for a page
+void *mem_alloc_aligned(size_t size, size_t alignment);
+// grows into a free neighbour or shrinks in place when it can, otherwise
+// moves the data; a size of 0 frees ptr and returns NULL
+void *mem_realloc(void *ptr, size_t size);
+void mem_free(void *ptr);
+// bytes the caller may use from ptr, at least what was asked for; works for
+// pointers from any heap
+size_t mem_usable_size(const void *ptr);
+
+// return the calling thread's cached blocks to the shared heap;
+// happens automatically when a thread exits
+void mem_thread_flush(void);
+
+void mem_get_stats(mem_stats *out);
+
+// An independent heap with its own lock, placement policy and statistics, e.g.
+// one per subsystem so they neither contend nor interleave their blocks.
+// Its state is kept at the front of mem, which must stay mapped at the same
+// address until heap_destroy; the rest is handed out as-is, never remapped or
+// returned to the OS. A NULL mem reserves size bytes of fresh address space
+// instead (0 selects the default), committed as it is used.
+// Thread caches only serve the default heap, so a threaded instance heap
+// takes its lock on every call
+typedef struct heap heap_t;
+
+heap_t *heap_create(void *mem, size_t size);
+// cfg may be NULL; a non-zero size takes precedence over its max_size
+heap_t *heap_create_config(void *mem, size_t size, const mem_config *cfg);
+// releases a reservation made by the heap; caller memory is left untouched
+void heap_destroy(heap_t *heap);
+
+void *heap_alloc(heap_t *heap, size_t size);
+void *heap_alloc_aligned(heap_t *heap, size_t size, size_t alignment);
+void *heap_realloc(heap_t *heap, void *ptr, size_t size);
+void heap_free(heap_t *heap, void *ptr);
+void heap_get_stats(heap_t *heap, mem_stats *out);
+
+// Relocatable blocks. Compaction may move a handle's block whenever it is not
+// locked, so its address is only valid between mem_handle_lock and the
+// matching unlock; locks nest. Handle blocks are freed with mem_handle_free,
+// never mem_free. 0 is never a valid handle
+typedef uint32_t mem_handle;
+
+mem_handle mem_handle_alloc(size_t size);
+void mem_handle_free(mem_handle handle);
+void *mem_handle_lock(mem_handle handle);
+void mem_handle_unlock(mem_handle handle);
+// move unlocked handle blocks down into the free holes below them, for at most
+// budget_ns; returns 1 once a whole pass over the heap is done, 0 if it ran out
+// of time and will resume from there on the next call. Buddy heaps never move
+int mem_compact(uint64_t budget_ns);
+
+mem_handle heap_handle_alloc(heap_t *heap, size_t size);
+void heap_handle_free(heap_t *heap, mem_handle handle);
+void *heap_handle_lock(heap_t *heap, mem_handle handle);
+void heap_handle_unlock(heap_t *heap, mem_handle handle);
+int heap_compact(heap_t *heap, uint64_t budget_ns);
+
+// log every mem_alloc/mem_alloc_aligned/mem_realloc/mem_free call to out,
+// in the trace format replayed by mem_replay
+void mem_trace_start(FILE *out);
+void mem_trace_stop(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
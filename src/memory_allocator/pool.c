@@ -0,0 +1,165 @@
+/*
+Slab allocator
+  A pool hands out objects of one fixed size. Objects live in slabs: aligned
+  pages taken from the heap with a small header at the front, so the slab of
+  any object is found by masking its address. Free objects in a slab are linked
+  through their own storage, and the part of a slab that was never handed out
+  is carved lazily so a new slab is not touched all at once.
+
+  Slabs sit on one of three lists: partial (some objects free), full and empty.
+  Allocation prefers partial slabs to keep objects packed; at most one empty
+  slab is kept around, the rest go back to the heap.
+*/
+
+#include <stdint.h>
+
+#include "pool.h"
+#include "memory_allocator.h"
+
+#define SLAB_SZ (64 << 10)
+#define POOL_ALIGN 16
+// smallest number of objects a slab should hold
+#define SLAB_MIN_OBJS 8
+
+typedef struct slab
+{
+    struct slab *next;
+    struct slab *prev;
+    void *free;
+    char *unused;
+    size_t inuse;
+} slab;
+
+struct pool
+{
+    slab *partial;
+    slab *full;
+    slab *empty;
+    size_t obj_size;
+    size_t slab_size;
+    size_t offset;
+    size_t capacity;
+};
+
+static void list_push(slab **head, slab *s)
+{
+    s->prev = NULL;
+    s->next = *head;
+    if (*head) (*head)->prev = s;
+    *head = s;
+}
+
+static void list_remove(slab **head, slab *s)
+{
+    if (s->prev) s->prev->next = s->next;
+    else *head = s->next;
+    if (s->next) s->next->prev = s->prev;
+}
+
+static void list_release(slab *s)
+{
+    while (s)
+    {
+        slab *next = s->next;
+        mem_free(s);
+        s = next;
+    }
+}
+
+pool *pool_create(size_t obj_size, size_t align)
+{
+    if (!align) align = POOL_ALIGN;
+    if (align & (align - 1)) return NULL;
+
+    // every object has to be able to hold the free list link
+    if (obj_size < sizeof(void *)) obj_size = sizeof(void *);
+    if (align < _Alignof(void *)) align = _Alignof(void *);
+    if (align > SIZE_MAX / 2 || obj_size > SIZE_MAX - (align - 1)) return NULL;
+    obj_size = (obj_size + align - 1) & ~(align - 1);
+
+    // the slab must hold SLAB_MIN_OBJS objects and still be a power of two
+    size_t offset = (sizeof(slab) + align - 1) & ~(align - 1);
+    if (obj_size > (SIZE_MAX - offset) / SLAB_MIN_OBJS) return NULL;
+    size_t need = offset + SLAB_MIN_OBJS * obj_size;
+    if (need > SIZE_MAX / 2 + 1) return NULL;
+    size_t slab_size = SLAB_SZ;
+    while (slab_size < need) slab_size <<= 1;
+
+    pool *p = mem_alloc(sizeof(pool));
+    if (!p) return NULL;
+    p->partial = NULL;
+    p->full = NULL;
+    p->empty = NULL;
+    p->obj_size = obj_size;
+    p->slab_size = slab_size;
+    p->offset = offset;
+    p->capacity = (slab_size - offset) / obj_size;
+    return p;
+}
+
+void pool_destroy(pool *p)
+{
+    if (!p) return;
+    list_release(p->partial);
+    list_release(p->full);
+    list_release(p->empty);
+    mem_free(p);
+}
+
+static slab *slab_create(pool *p)
+{
+    slab *s = mem_alloc_aligned(p->slab_size, p->slab_size);
+    if (!s) return NULL;
+    s->free = NULL;
+    s->unused = (char *)s + p->offset;
+    s->inuse = 0;
+    return s;
+}
+
+void *pool_alloc(pool *p)
+{
+    slab *s = p->partial;
+    if (!s)
+    {
+        s = p->empty;
+        if (s) list_remove(&p->empty, s);
+        else if (!(s = slab_create(p))) return NULL;
+        list_push(&p->partial, s);
+    }
+
+    void *obj = s->free;
+    if (obj) s->free = *(void **)obj;
+    else
+    {
+        obj = s->unused;
+        s->unused += p->obj_size;
+    }
+
+    if (++s->inuse == p->capacity)
+    {
+        list_remove(&p->partial, s);
+        list_push(&p->full, s);
+    }
+    return obj;
+}
+
+void pool_free(pool *p, void *obj)
+{
+    if (!obj) return;
+    slab *s = (slab *)((uintptr_t)obj & ~(uintptr_t)(p->slab_size - 1));
+
+    *(void **)obj = s->free;
+    s->free = obj;
+
+    if (s->inuse-- == p->capacity)
+    {
+        list_remove(&p->full, s);
+        list_push(&p->partial, s);
+    }
+    if (s->inuse == 0)
+    {
+        list_remove(&p->partial, s);
+        if (p->empty) mem_free(s);
+        else list_push(&p->empty, s);
+    }
+}
@@ -0,0 +1,23 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct pool pool;
+
+// align must be a power of two, 0 for the same alignment as mem_alloc
+pool *pool_create(size_t obj_size, size_t align);
+void pool_destroy(pool *p);
+
+void *pool_alloc(pool *p);
+void pool_free(pool *p, void *obj);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,107 @@
+#include <gtest/gtest.h>
+#include <stdint.h>
+#include <cstring>
+#include <vector>
+
+#include "arena.h"
+#include "memory_allocator.h"
+
+class ArenaTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        mem_init();
+        a = arena_create(4096);
+        ASSERT_NE(nullptr, a);
+    }
+    void TearDown() override {
+        arena_destroy(a);
+    }
+
+    arena *a = nullptr;
+};
+
+TEST_F(ArenaTest, BumpAllocation) {
+    uint8_t *p1 = (uint8_t*)arena_alloc(a, 10);
+    uint8_t *p2 = (uint8_t*)arena_alloc(a, 20);
+    ASSERT_NE(nullptr, p1);
+    ASSERT_NE(nullptr, p2);
+
+    // Consecutive allocations are packed at ALIGNMENT granularity
+    EXPECT_EQ(p1 + 16, p2);
+    EXPECT_EQ(0u, (uintptr_t)p1 % 16);
+    EXPECT_EQ(0u, (uintptr_t)p2 % 16);
+
+    memset(p1, 0x11, 10);
+    memset(p2, 0x22, 20);
+    EXPECT_EQ(0x11, p1[9]);
+    EXPECT_EQ(0x22, p2[0]);
+}
+
+TEST_F(ArenaTest, ZeroSizeAllocation) {
+    EXPECT_NE(nullptr, arena_alloc(a, 0));
+}
+
+TEST_F(ArenaTest, SpillsIntoNewChunks) {
+    std::vector<uint8_t*> ptrs;
+    for (int i = 0; i < 1000; i++) {
+        uint8_t *p = (uint8_t*)arena_alloc(a, 100);
+        ASSERT_NE(nullptr, p);
+        memset(p, i & 0xFF, 100);
+        ptrs.push_back(p);
+    }
+    for (int i = 0; i < 1000; i++) {
+        EXPECT_EQ(i & 0xFF, ptrs[i][0]);
+        EXPECT_EQ(i & 0xFF, ptrs[i][99]);
+    }
+}
+
+TEST_F(ArenaTest, OversizedAllocation) {
+    uint8_t *p = (uint8_t*)arena_alloc(a, 1 << 20);
+    ASSERT_NE(nullptr, p);
+    memset(p, 0x7F, 1 << 20);
+
+    // Regular allocations keep working afterwards
+    EXPECT_NE(nullptr, arena_alloc(a, 32));
+}
+
+TEST_F(ArenaTest, HugeSizesAreRejected) {
+    // Rounding or adding the chunk header would wrap these
+    EXPECT_EQ(nullptr, arena_alloc(a, SIZE_MAX));
+    EXPECT_EQ(nullptr, arena_alloc(a, SIZE_MAX - 40));
+    EXPECT_EQ(nullptr, arena_alloc(a, SIZE_MAX / 2));
+
+    // The arena is unharmed and still serves ordinary requests
+    char *p = (char *)arena_alloc(a, 64);
+    ASSERT_NE(nullptr, p);
+    memset(p, 0xAB, 64);
+}
+
+TEST_F(ArenaTest, ResetToMark) {
+    arena_alloc(a, 64);
+    arena_pos mark = arena_mark(a);
+
+    void *first = arena_alloc(a, 64);
+    for (int i = 0; i < 500; i++) {
+        ASSERT_NE(nullptr, arena_alloc(a, 100));
+    }
+
+    // Rewinding hands out the same memory again
+    arena_reset_to_mark(a, mark);
+    EXPECT_EQ(first, arena_alloc(a, 64));
+}
+
+TEST_F(ArenaTest, ResetReturnsChunksToHeap) {
+    for (int i = 0; i < 100; i++) {
+        ASSERT_NE(nullptr, arena_alloc(a, 4000));
+    }
+    arena_reset(a);
+    EXPECT_NE(nullptr, arena_alloc(a, 16));
+
+    arena_destroy(a);
+    a = nullptr;
+
+    // With the arena gone the heap coalesces back into one block
+    void *whole = mem_alloc((1 << 30) - 4096);
+    EXPECT_NE(nullptr, whole);
+    mem_free(whole);
+}
@@ -1,12 +1,17 @@
 #include <gtest/gtest.h>
 #include <stdint.h>
 #include <cstring>
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
-extern "C" {
-    void mem_init();
-    void *mem_alloc(size_t size);
-    void mem_free(void *ptr);
-}
+#include "memory_allocator.h"
 
 class MemoryAllocatorTest : public ::testing::Test {
 protected:
@@ -275,4 +280,891 @@ TEST_F(MemoryAllocatorTest, MinimumAllocationSize) {
     
     mem_free(ptr1);
     mem_free(ptr2);
-}
\ No newline at end of file
+}
+
+TEST_F(MemoryAllocatorTest, SizeClassReuse) {
+    // A freed block surrounded by live blocks goes to its size-class bin
+    // and is handed straight back to the next request of that size
+    std::vector<void*> ptrs;
+    for (int i = 0; i < 10000; i++) {
+        ptrs.push_back(mem_alloc(64));
+        ASSERT_NE(nullptr, ptrs.back());
+    }
+
+    void *hole = ptrs[5000];
+    mem_free(hole);
+    EXPECT_EQ(hole, mem_alloc(64));
+
+    for (void *p : ptrs) {
+        mem_free(p);
+    }
+}
+
+
+TEST_F(MemoryAllocatorTest, CoalesceWithBothNeighbours) {
+    void *a = mem_alloc(256);
+    void *b = mem_alloc(256);
+    void *c = mem_alloc(256);
+    void *guard = mem_alloc(16);
+
+    // Free the outer blocks first, then the middle one bridges them
+    mem_free(a);
+    mem_free(c);
+    mem_free(b);
+
+    // The merged hole starts at a and holds all three payloads plus two headers
+    void *merged = mem_alloc(3 * 256);
+    EXPECT_EQ(a, merged);
+
+    mem_free(merged);
+    mem_free(guard);
+}
+
+TEST_F(MemoryAllocatorTest, TeardownManyBlocks) {
+    // Freeing a large heap in allocation order must leave one free block again
+    std::vector<void*> ptrs;
+    for (int i = 0; i < 100000; i++) {
+        ptrs.push_back(mem_alloc(32 + (i % 7) * 16));
+        ASSERT_NE(nullptr, ptrs.back());
+    }
+    for (void *p : ptrs) {
+        mem_free(p);
+    }
+
+    void *first = mem_alloc(1 << 20);
+    EXPECT_EQ(ptrs[0], first);
+    mem_free(first);
+}
+
+
+TEST_F(MemoryAllocatorTest, ConfiguredMaximumSize) {
+    mem_config cfg{};
+    cfg.max_size = 8 << 20;
+    mem_init_config(&cfg);
+
+    EXPECT_EQ(nullptr, mem_alloc(16 << 20));
+    void *ptr = mem_alloc(4 << 20);
+    EXPECT_NE(nullptr, ptr);
+    mem_free(ptr);
+}
+
+TEST_F(MemoryAllocatorTest, FreedTailReturnedToOS) {
+    const size_t size = 64 << 20;
+    uint8_t *ptr = (uint8_t*)mem_alloc(size);
+    ASSERT_NE(nullptr, ptr);
+    memset(ptr, 0x5A, size);
+    mem_free(ptr);
+
+    // Everything past the first chunk of the freed tail should be non-resident
+    long page = sysconf(_SC_PAGESIZE);
+    uint8_t *start = (uint8_t*)(((uintptr_t)ptr + (2 << 20)) & ~(uintptr_t)(page - 1));
+    size_t len = size - (4 << 20);
+    std::vector<unsigned char> residency(len / page);
+    ASSERT_EQ(0, mincore(start, len, residency.data()));
+    size_t resident = 0;
+    for (unsigned char r : residency) resident += r & 1;
+    EXPECT_EQ(0u, resident);
+
+    // The space is still usable afterwards
+    ptr = (uint8_t*)mem_alloc(size);
+    ASSERT_NE(nullptr, ptr);
+    EXPECT_EQ(0, ptr[size - 1]);
+    mem_free(ptr);
+}
+
+TEST_F(MemoryAllocatorTest, DefaultAlignment) {
+    // Odd sizes must not push later blocks off max_align_t alignment
+    for (size_t size = 1; size < 200; size += 7) {
+        void *ptr = mem_alloc(size);
+        ASSERT_NE(nullptr, ptr);
+        EXPECT_EQ(0u, (uintptr_t)ptr % alignof(max_align_t)) << "size " << size;
+    }
+}
+
+TEST_F(MemoryAllocatorTest, AlignedAllocation) {
+    size_t alignments[] = {16, 32, 64, 256, 4096, 1 << 16};
+    std::vector<void*> ptrs;
+
+    for (size_t alignment : alignments) {
+        // A small allocation in between keeps the heap from staying aligned by luck
+        ptrs.push_back(mem_alloc(24));
+        void *ptr = mem_alloc_aligned(100, alignment);
+        ASSERT_NE(nullptr, ptr);
+        EXPECT_EQ(0u, (uintptr_t)ptr % alignment) << "alignment " << alignment;
+        memset(ptr, 0xEE, 100);
+        ptrs.push_back(ptr);
+    }
+
+    for (void *p : ptrs) {
+        mem_free(p);
+    }
+
+    // The space skipped for alignment went back to the heap
+    void *whole = mem_alloc((1 << 30) - 4096);
+    EXPECT_NE(nullptr, whole);
+    mem_free(whole);
+}
+
+TEST_F(MemoryAllocatorTest, InvalidAlignment) {
+    EXPECT_EQ(nullptr, mem_alloc_aligned(64, 0));
+    EXPECT_EQ(nullptr, mem_alloc_aligned(64, 48));
+}
+
+TEST_F(MemoryAllocatorTest, ReallocGrowsInPlace) {
+    uint8_t *ptr = (uint8_t*)mem_alloc(100);
+    ASSERT_NE(nullptr, ptr);
+    memset(ptr, 0x42, 100);
+
+    // Nothing follows the block, so it can keep growing where it is
+    for (size_t size = 200; size <= (8 << 20); size *= 2) {
+        uint8_t *grown = (uint8_t*)mem_realloc(ptr, size);
+        ASSERT_EQ(ptr, grown) << "size " << size;
+    }
+    for (int i = 0; i < 100; i++) EXPECT_EQ(0x42, ptr[i]);
+
+    mem_free(ptr);
+}
+
+TEST_F(MemoryAllocatorTest, ReallocIntoFreedNeighbour) {
+    void *a = mem_alloc(128);
+    void *b = mem_alloc(128);
+    void *guard = mem_alloc(16);
+
+    mem_free(b);
+    EXPECT_EQ(a, mem_realloc(a, 256));
+
+    mem_free(a);
+    mem_free(guard);
+}
+
+TEST_F(MemoryAllocatorTest, ReallocShrinkReleasesTail) {
+    uint8_t *a = (uint8_t*)mem_alloc(1024);
+    void *guard = mem_alloc(16);
+
+    EXPECT_EQ(a, mem_realloc(a, 128));
+
+    // The released tail is the first fit for the next request
+    void *tail = mem_alloc(512);
+    EXPECT_GT((uint8_t*)tail, a);
+    EXPECT_LT((uint8_t*)tail, (uint8_t*)guard);
+
+    mem_free(a);
+    mem_free(tail);
+    mem_free(guard);
+}
+
+TEST_F(MemoryAllocatorTest, ReallocMovesWhenBlocked) {
+    uint8_t *a = (uint8_t*)mem_alloc(64);
+    void *neighbour = mem_alloc(64);
+    for (int i = 0; i < 64; i++) a[i] = i;
+
+    uint8_t *moved = (uint8_t*)mem_realloc(a, 4096);
+    ASSERT_NE(nullptr, moved);
+    EXPECT_NE(a, moved);
+    for (int i = 0; i < 64; i++) EXPECT_EQ(i, moved[i]);
+
+    mem_free(moved);
+    mem_free(neighbour);
+}
+
+TEST_F(MemoryAllocatorTest, ReallocEdgeCases) {
+    void *ptr = mem_realloc(nullptr, 32);
+    EXPECT_NE(nullptr, ptr);
+    EXPECT_EQ(nullptr, mem_realloc(ptr, 0));
+
+    // A failed realloc leaves the original block alone
+    ptr = mem_alloc(32);
+    EXPECT_EQ(nullptr, mem_realloc(ptr, (size_t)1 << 40));
+    mem_free(ptr);
+}
+
+TEST_F(MemoryAllocatorTest, Statistics) {
+#ifndef MEM_STATS
+    GTEST_SKIP() << "built without MEM_STATS";
+#endif
+    mem_stats stats;
+    mem_get_stats(&stats);
+    EXPECT_EQ(0u, stats.allocs);
+    EXPECT_EQ(0u, stats.bytes_live);
+
+    void *ptrs[8];
+    for (int i = 0; i < 8; i++) {
+        ptrs[i] = mem_alloc(100);
+    }
+    mem_get_stats(&stats);
+    EXPECT_EQ(8u, stats.allocs);
+    EXPECT_EQ(8u * 112, stats.bytes_live);
+    EXPECT_EQ(8u, stats.histogram[6]);
+    EXPECT_EQ(1u, stats.free_blocks);
+    EXPECT_DOUBLE_EQ(0.0, stats.fragmentation);
+    EXPECT_GE(stats.avg_scanned, 1.0);
+
+    // Punch holes so free memory is split into several blocks
+    for (int i = 0; i < 8; i += 2) {
+        mem_free(ptrs[i]);
+    }
+    mem_get_stats(&stats);
+    EXPECT_EQ(4u, stats.frees);
+    EXPECT_EQ(4u * 112, stats.bytes_live);
+    EXPECT_EQ(8u * 112, stats.peak_bytes);
+    EXPECT_EQ(5u, stats.free_blocks);
+    EXPECT_GT(stats.fragmentation, 0.0);
+    EXPECT_LT(stats.fragmentation, 0.01);
+
+    for (int i = 1; i < 8; i += 2) {
+        mem_free(ptrs[i]);
+    }
+    mem_get_stats(&stats);
+    EXPECT_EQ(0u, stats.bytes_live);
+    EXPECT_EQ(1u, stats.free_blocks);
+    EXPECT_EQ(stats.free_bytes, stats.largest_free);
+}
+
+TEST_F(MemoryAllocatorTest, TraceRecordsCalls) {
+    char *buf = nullptr;
+    size_t len = 0;
+    FILE *out = open_memstream(&buf, &len);
+    ASSERT_NE(nullptr, out);
+
+    mem_trace_start(out);
+    void *a = mem_alloc(100);
+    void *b = mem_alloc_aligned(64, 256);
+    void *c = mem_realloc(a, 300);
+    mem_free(b);
+    mem_free(c);
+    mem_trace_stop();
+    void *untraced = mem_alloc(10);
+    mem_free(untraced);
+    fclose(out);
+
+    char expected[256];
+    snprintf(expected, sizeof(expected), "a %lx 100\na %lx 64 256\nr %lx %lx 300\nf %lx\nf %lx\n",
+             (unsigned long)(uintptr_t)a, (unsigned long)(uintptr_t)b, (unsigned long)(uintptr_t)a,
+             (unsigned long)(uintptr_t)c, (unsigned long)(uintptr_t)b, (unsigned long)(uintptr_t)c);
+    EXPECT_STREQ(expected, buf);
+    free(buf);
+}
+
+TEST_F(MemoryAllocatorTest, HeapOverCallerMemory) {
+    alignas(64) static uint8_t region[64 * 1024];
+    heap_t *heap = heap_create(region, sizeof(region));
+    ASSERT_NE(nullptr, heap);
+
+    // The heap never hands out memory outside the region it was given
+    std::vector<uint8_t*> ptrs;
+    while (uint8_t *p = (uint8_t*)heap_alloc(heap, 1000)) {
+        EXPECT_GE(p, region);
+        EXPECT_LE(p + 1000, region + sizeof(region));
+        memset(p, 0xCD, 1000);
+        ptrs.push_back(p);
+    }
+    EXPECT_GT(ptrs.size(), 50u);
+
+    // The default heap is unaffected
+    void *outside = mem_alloc(1000);
+    ASSERT_NE(nullptr, outside);
+    EXPECT_TRUE((uint8_t*)outside < region || (uint8_t*)outside >= region + sizeof(region));
+    mem_free(outside);
+
+    for (uint8_t *p : ptrs) heap_free(heap, p);
+    void *big = heap_alloc(heap, sizeof(region) / 2);
+    EXPECT_NE(nullptr, big);
+    heap_free(heap, big);
+    heap_destroy(heap);
+
+    // Too small to hold the heap's own state
+    EXPECT_EQ(nullptr, heap_create(region, 64));
+}
+
+TEST_F(MemoryAllocatorTest, IndependentHeaps) {
+    mem_config cfg = {};
+    cfg.policy = MEM_POLICY_BEST_FIT;
+    heap_t *a = heap_create(nullptr, 16 << 20);
+    heap_t *b = heap_create_config(nullptr, 16 << 20, &cfg);
+    ASSERT_NE(nullptr, a);
+    ASSERT_NE(nullptr, b);
+
+    uint8_t *pa = (uint8_t*)heap_alloc(a, 4096);
+    uint8_t *pb = (uint8_t*)heap_alloc_aligned(b, 4096, 4096);
+    ASSERT_NE(nullptr, pa);
+    ASSERT_NE(nullptr, pb);
+    EXPECT_EQ(0u, (uintptr_t)pb % 4096);
+    memset(pa, 1, 4096);
+    memset(pb, 2, 4096);
+
+    pa = (uint8_t*)heap_realloc(a, pa, 1 << 20);
+    ASSERT_NE(nullptr, pa);
+    EXPECT_EQ(1, pa[4095]);
+    EXPECT_EQ(2, pb[4095]);
+
+    // Each heap is capped at its own size
+    EXPECT_EQ(nullptr, heap_alloc(a, 32 << 20));
+
+    mem_stats stats;
+    heap_get_stats(b, &stats);
+#ifdef MEM_STATS
+    EXPECT_EQ(1u, stats.allocs);
+#endif
+
+    heap_free(a, pa);
+    heap_free(b, pb);
+    heap_destroy(a);
+    heap_destroy(b);
+}
+
+TEST_F(MemoryAllocatorTest, HugePageHeap) {
+    mem_config cfg = {};
+    cfg.huge_pages = 1;
+    heap_t *heap = heap_create_config(nullptr, 64 << 20, &cfg);
+    ASSERT_NE(nullptr, heap);
+
+    mem_stats stats;
+    heap_get_stats(heap, &stats);
+    EXPECT_TRUE(stats.backing == MEM_BACKING_HUGETLB || stats.backing == MEM_BACKING_TRANSPARENT);
+
+    // Large blocks go to the top of free memory, small ones stay packed below
+    uint8_t *a = (uint8_t*)heap_alloc(heap, 64);
+    uint8_t *large = (uint8_t*)heap_alloc(heap, 1 << 20);
+    uint8_t *b = (uint8_t*)heap_alloc(heap, 64);
+    ASSERT_NE(nullptr, a);
+    ASSERT_NE(nullptr, large);
+    ASSERT_NE(nullptr, b);
+    EXPECT_LT(b, large);
+    EXPECT_LT(b - a, 256);
+    memset(large, 1, 1 << 20);
+
+    heap_get_stats(heap, &stats);
+#ifdef MEM_STATS
+    EXPECT_EQ(0u, stats.committed % (2 << 20));
+#endif
+
+    heap_free(heap, large);
+    heap_free(heap, a);
+    heap_free(heap, b);
+    void *whole = heap_alloc(heap, (64 << 20) - 4096);
+    EXPECT_NE(nullptr, whole);
+    heap_free(heap, whole);
+    heap_destroy(heap);
+}
+
+// Fills a heap with handle blocks tagged with their index, then frees every other one
+static std::vector<mem_handle> fragment_with_handles(heap_t *heap, int count, size_t size) {
+    std::vector<mem_handle> handles;
+    for (int i = 0; i < count; i++) {
+        mem_handle handle = heap_handle_alloc(heap, size);
+        EXPECT_NE(0u, handle);
+        memset(heap_handle_lock(heap, handle), i & 0xFF, size);
+        heap_handle_unlock(heap, handle);
+        handles.push_back(handle);
+    }
+    for (int i = 0; i < count; i += 2) {
+        heap_handle_free(heap, handles[i]);
+        handles[i] = 0;
+    }
+    return handles;
+}
+
+static bool handle_intact(heap_t *heap, mem_handle handle, int i, size_t size) {
+    uint8_t *p = (uint8_t*)heap_handle_lock(heap, handle);
+    bool ok = std::all_of(p, p + size, [i](uint8_t b) { return b == (uint8_t)(i & 0xFF); });
+    heap_handle_unlock(heap, handle);
+    return ok;
+}
+
+TEST_F(MemoryAllocatorTest, CompactionMergesHoles) {
+    const size_t size = 8192;
+    heap_t *heap = heap_create(nullptr, 64 << 20);
+    ASSERT_NE(nullptr, heap);
+    std::vector<mem_handle> handles = fragment_with_handles(heap, 1024, size);
+    uint8_t *highest = (uint8_t*)heap_handle_lock(heap, handles.back());
+    heap_handle_unlock(heap, handles.back());
+
+    mem_stats before, after;
+    heap_get_stats(heap, &before);
+
+    // Pin one block in the middle, it must stay where it is
+    uint8_t *pinned = (uint8_t*)heap_handle_lock(heap, handles[511]);
+
+    // A zero budget makes no progress, an unlimited one finishes the pass
+    EXPECT_EQ(0, heap_compact(heap, 0));
+    EXPECT_EQ(1, heap_compact(heap, UINT64_MAX));
+    EXPECT_EQ(pinned, heap_handle_lock(heap, handles[511]));
+    heap_handle_unlock(heap, handles[511]);
+    heap_handle_unlock(heap, handles[511]);
+
+    for (int i = 1; i < 1024; i += 2) {
+        EXPECT_TRUE(handle_intact(heap, handles[i], i, size)) << "handle " << i;
+    }
+
+    // Half the holes merged above the pinned block, so a large block now fits
+    // below where the highest handle used to be
+    uint8_t *large = (uint8_t*)heap_alloc(heap, 2 << 20);
+    ASSERT_NE(nullptr, large);
+    EXPECT_LT(large, highest);
+    heap_get_stats(heap, &after);
+#ifdef MEM_STATS
+    EXPECT_LE(after.committed, before.committed);
+    EXPECT_LT(after.free_blocks, before.free_blocks);
+#endif
+
+    heap_free(heap, large);
+    for (mem_handle handle : handles) heap_handle_free(heap, handle);
+    heap_destroy(heap);
+}
+
+TEST_F(MemoryAllocatorTest, CompactionInSmallSteps) {
+    const size_t size = 4096;
+    heap_t *heap = heap_create(nullptr, 64 << 20);
+    ASSERT_NE(nullptr, heap);
+    std::vector<mem_handle> handles = fragment_with_handles(heap, 2048, size);
+
+    // Each call resumes where the last one stopped, in between the heap stays usable
+    int calls = 1;
+    while (!heap_compact(heap, 20000)) {
+        void *p = heap_alloc(heap, 100);
+        ASSERT_NE(nullptr, p);
+        heap_free(heap, p);
+        calls++;
+    }
+    EXPECT_GT(calls, 1);
+
+    for (int i = 1; i < 2048; i += 2) {
+        EXPECT_TRUE(handle_intact(heap, handles[i], i, size)) << "handle " << i;
+    }
+    for (mem_handle handle : handles) heap_handle_free(heap, handle);
+    heap_destroy(heap);
+}
+
+TEST_F(MemoryAllocatorTest, CompactionBeforeGrowing) {
+    mem_config cfg = {};
+    cfg.compact_budget_ns = 1000000000;
+    heap_t *heap = heap_create_config(nullptr, 64 << 20, &cfg);
+    ASSERT_NE(nullptr, heap);
+    std::vector<mem_handle> handles = fragment_with_handles(heap, 1024, 8192);
+    uint8_t *highest = (uint8_t*)heap_handle_lock(heap, handles.back());
+    heap_handle_unlock(heap, handles.back());
+
+    // No hole fits, so the allocation compacts instead of committing more memory
+    uint8_t *large = (uint8_t*)heap_alloc(heap, 2 << 20);
+    ASSERT_NE(nullptr, large);
+    EXPECT_LT(large, highest);
+    for (int i = 1; i < 1024; i += 2) {
+        EXPECT_TRUE(handle_intact(heap, handles[i], i, 8192)) << "handle " << i;
+    }
+
+    heap_free(heap, large);
+    for (mem_handle handle : handles) heap_handle_free(heap, handle);
+    heap_destroy(heap);
+}
+
+class ThreadedAllocatorTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        mem_config cfg{};
+        cfg.threaded = 1;
+        mem_init_config(&cfg);
+    }
+    void TearDown() override {
+        mem_thread_flush();
+        mem_init();
+    }
+};
+
+TEST_F(ThreadedAllocatorTest, CachedBlockIsReused) {
+    void *ptr = mem_alloc(64);
+    ASSERT_NE(nullptr, ptr);
+    mem_free(ptr);
+
+    // The block sits in this thread's cache and comes straight back
+    EXPECT_EQ(ptr, mem_alloc(64));
+    mem_free(ptr);
+
+    // A second free of a cached block is ignored
+    mem_free(ptr);
+    void *a = mem_alloc(64);
+    void *b = mem_alloc(64);
+    EXPECT_NE(a, b);
+    mem_free(a);
+    mem_free(b);
+}
+
+TEST_F(ThreadedAllocatorTest, ProducerConsumerRecyclesRemotely) {
+    const int messages = 100000;
+    std::mutex lock;
+    std::deque<uint8_t*> queue;
+    std::atomic<int> corrupt{0};
+
+    std::thread producer([&]() {
+        for (int i = 0; i < messages; i++) {
+            uint8_t *msg = (uint8_t*)mem_alloc(64);
+            ASSERT_NE(nullptr, msg);
+            memset(msg, (uint8_t)i, 64);
+            for (;;) {
+                {
+                    std::lock_guard<std::mutex> guard(lock);
+                    if (queue.size() < 256) {
+                        queue.push_back(msg);
+                        break;
+                    }
+                }
+                std::this_thread::yield();
+            }
+        }
+    });
+    std::thread consumer([&]() {
+        for (int i = 0; i < messages;) {
+            uint8_t *msg = nullptr;
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                if (!queue.empty()) {
+                    msg = queue.front();
+                    queue.pop_front();
+                }
+            }
+            if (!msg) {
+                std::this_thread::yield();
+                continue;
+            }
+            if (msg[0] != (uint8_t)i || msg[63] != (uint8_t)i) corrupt++;
+            mem_free(msg);
+            i++;
+        }
+    });
+    producer.join();
+    consumer.join();
+    EXPECT_EQ(0, corrupt.load());
+
+#ifdef MEM_STATS
+    // Freed messages flow back to the producer's cache instead of the heap
+    mem_stats stats;
+    mem_get_stats(&stats);
+    EXPECT_LT(stats.allocs, (size_t)messages / 10);
+#endif
+}
+
+TEST_F(ThreadedAllocatorTest, FreeAfterOwnerExits) {
+    std::vector<void*> blocks;
+    std::thread owner([&blocks]() {
+        for (int i = 0; i < 100; i++) blocks.push_back(mem_alloc(128));
+    });
+    owner.join();
+
+    // The owner's stack is closed, so these land in this thread's cache
+    for (void *p : blocks) mem_free(p);
+    mem_thread_flush();
+    void *whole = mem_alloc((1 << 30) - 4096);
+    EXPECT_NE(nullptr, whole);
+    mem_free(whole);
+}
+
+TEST_F(ThreadedAllocatorTest, UncachedSmallBlocksFreeCleanly) {
+    // Leave junk where the next headers will be carved out
+    void *junk = mem_alloc(1 << 20);
+    ASSERT_NE(nullptr, junk);
+    memset(junk, 0xFF, 1 << 20);
+    mem_free(junk);
+
+    // Small blocks that never went through a thread cache: aligned ones and
+    // large ones shrunk in place. Free half here and half on another thread
+    std::vector<void*> blocks;
+    std::thread worker([&blocks]() {
+        for (int i = 0; i < 64; i++) {
+            void *aligned = mem_alloc_aligned(48, 256);
+            ASSERT_NE(nullptr, aligned);
+            EXPECT_EQ(0u, (uintptr_t)aligned % 256);
+            void *shrunk = mem_realloc(mem_alloc(4096), 64);
+            ASSERT_NE(nullptr, shrunk);
+            blocks.push_back(aligned);
+            blocks.push_back(shrunk);
+        }
+        for (size_t i = 0; i < blocks.size(); i += 2) mem_free(blocks[i]);
+    });
+    worker.join();
+    for (size_t i = 1; i < blocks.size(); i += 2) mem_free(blocks[i]);
+
+    mem_thread_flush();
+    void *whole = mem_alloc((1 << 30) - 4096);
+    EXPECT_NE(nullptr, whole);
+    mem_free(whole);
+}
+
+TEST_F(ThreadedAllocatorTest, ForkWhileThreadsComeAndGo) {
+#if defined(__SANITIZE_ADDRESS__) || defined(__SANITIZE_THREAD__)
+    // the sanitizer runtimes can deadlock a child forked while threads start,
+    // whatever allocator is underneath
+    GTEST_SKIP();
+#endif
+    // Threads starting and exiting keep claiming and releasing remote stacks
+    std::atomic<bool> stop{false};
+    std::thread churn([&stop]() {
+        while (!stop) {
+            std::thread t([]() { mem_free(mem_alloc(32)); });
+            t.join();
+        }
+    });
+
+    for (int i = 0; i < 50; i++) {
+        pid_t pid = fork();
+        ASSERT_GE(pid, 0);
+        if (pid == 0) {
+            // a deadlocked child is killed rather than hanging the test
+            alarm(5);
+            std::thread t([]() { mem_free(mem_alloc(32)); });
+            t.join();
+            _exit(0);
+        }
+        int status = 0;
+        ASSERT_EQ(pid, waitpid(pid, &status, 0));
+        EXPECT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0) << "child " << i;
+    }
+    stop = true;
+    churn.join();
+}
+
+TEST_F(ThreadedAllocatorTest, ConcurrentAllocFree) {
+    const int num_threads = 8;
+    const int iterations = 20000;
+    std::vector<std::thread> threads;
+    std::vector<int> failures(num_threads, 0);
+
+    for (int t = 0; t < num_threads; t++) {
+        threads.emplace_back([t, &failures]() {
+            std::vector<std::pair<uint8_t*, size_t>> live;
+            unsigned seed = t + 1;
+            for (int i = 0; i < iterations; i++) {
+                seed = seed * 1103515245 + 12345;
+                size_t size = (seed >> 16) % 2048 + 1;
+                uint8_t *p = (uint8_t*)mem_alloc(size);
+                if (!p) { failures[t]++; continue; }
+                memset(p, (uint8_t)t, size);
+                live.push_back({p, size});
+
+                if (live.size() > 64 || (seed & 1)) {
+                    auto victim = live[(seed >> 8) % live.size()];
+                    for (size_t j = 0; j < victim.second; j++) {
+                        if (victim.first[j] != (uint8_t)t) { failures[t]++; break; }
+                    }
+                    mem_free(victim.first);
+                    live.erase(std::find(live.begin(), live.end(), victim));
+                }
+            }
+            for (auto &entry : live) mem_free(entry.first);
+        });
+    }
+    for (auto &th : threads) th.join();
+
+    for (int t = 0; t < num_threads; t++) {
+        EXPECT_EQ(0, failures[t]) << "thread " << t;
+    }
+
+    // Exiting threads flush their caches, so the heap coalesces back into one block
+    void *whole = mem_alloc((1 << 30) - 4096);
+    EXPECT_NE(nullptr, whole);
+    mem_free(whole);
+}
+
+TEST_F(ThreadedAllocatorTest, SharedInstanceHeap) {
+    mem_config cfg = {};
+    cfg.threaded = 1;
+    heap_t *heap = heap_create_config(nullptr, 64 << 20, &cfg);
+    ASSERT_NE(nullptr, heap);
+
+    const int num_threads = 4;
+    std::vector<std::thread> threads;
+    std::vector<int> failures(num_threads, 0);
+    for (int t = 0; t < num_threads; t++) {
+        threads.emplace_back([t, heap, &failures]() {
+            std::vector<uint8_t*> live;
+            for (int i = 0; i < 10000; i++) {
+                uint8_t *p = (uint8_t*)heap_alloc(heap, 64 + i % 512);
+                if (!p) { failures[t]++; continue; }
+                p[0] = (uint8_t)t;
+                live.push_back(p);
+                if (live.size() > 32) {
+                    if (live.front()[0] != (uint8_t)t) failures[t]++;
+                    heap_free(heap, live.front());
+                    live.erase(live.begin());
+                }
+            }
+            for (uint8_t *p : live) heap_free(heap, p);
+        });
+    }
+    for (auto &th : threads) th.join();
+
+    for (int t = 0; t < num_threads; t++) {
+        EXPECT_EQ(0, failures[t]) << "thread " << t;
+    }
+    // Nothing is left in thread caches, the heap is whole again right away
+    void *whole = heap_alloc(heap, (64 << 20) - 4096);
+    EXPECT_NE(nullptr, whole);
+    heap_free(heap, whole);
+    heap_destroy(heap);
+}
+
+
+class PolicyTest : public ::testing::TestWithParam<mem_policy> {
+protected:
+    void SetUp() override {
+        mem_config cfg{};
+        cfg.policy = GetParam();
+        mem_init_config(&cfg);
+    }
+    void TearDown() override {
+        mem_init();
+    }
+};
+
+TEST_P(PolicyTest, RandomWorkloadIntegrity) {
+    std::vector<std::pair<uint8_t*, size_t>> live;
+    unsigned seed = 42;
+
+    for (int i = 0; i < 20000; i++) {
+        seed = seed * 1103515245 + 12345;
+        if (live.empty() || (seed >> 16) % 3) {
+            size_t size = (seed >> 8) % 4096 + 1;
+            uint8_t *p = (uint8_t*)mem_alloc(size);
+            ASSERT_NE(nullptr, p);
+            EXPECT_EQ(0u, (uintptr_t)p % 16);
+            memset(p, (uint8_t)size, size);
+            live.push_back({p, size});
+        } else {
+            size_t victim = (seed >> 4) % live.size();
+            auto entry = live[victim];
+            for (size_t j = 0; j < entry.second; j++) {
+                ASSERT_EQ((uint8_t)entry.second, entry.first[j]);
+            }
+            mem_free(entry.first);
+            live[victim] = live.back();
+            live.pop_back();
+        }
+    }
+    for (auto &entry : live) mem_free(entry.first);
+
+    // Everything coalesces back into a block spanning the heap
+    void *whole = mem_alloc((1 << 30) - 4096);
+    EXPECT_NE(nullptr, whole);
+    mem_free(whole);
+}
+
+TEST_P(PolicyTest, ReallocAndAlignedAllocation) {
+    uint8_t *p = (uint8_t*)mem_alloc(40);
+    ASSERT_NE(nullptr, p);
+    for (int i = 0; i < 40; i++) p[i] = i;
+
+    p = (uint8_t*)mem_realloc(p, 5000);
+    ASSERT_NE(nullptr, p);
+    for (int i = 0; i < 40; i++) EXPECT_EQ(i, p[i]);
+
+    p = (uint8_t*)mem_realloc(p, 20);
+    ASSERT_NE(nullptr, p);
+    for (int i = 0; i < 20; i++) EXPECT_EQ(i, p[i]);
+
+    uint8_t *aligned = (uint8_t*)mem_alloc_aligned(300, 4096);
+    ASSERT_NE(nullptr, aligned);
+    EXPECT_EQ(0u, (uintptr_t)aligned % 4096);
+    memset(aligned, 0x99, 300);
+
+    // Even an over-aligned block can be moved by realloc
+    aligned = (uint8_t*)mem_realloc(aligned, 10000);
+    ASSERT_NE(nullptr, aligned);
+    EXPECT_EQ(0x99, aligned[299]);
+
+    mem_free(aligned);
+    mem_free(p);
+
+    void *whole = mem_alloc((1 << 30) - 4096);
+    EXPECT_NE(nullptr, whole);
+    mem_free(whole);
+}
+
+INSTANTIATE_TEST_SUITE_P(AllPolicies, PolicyTest,
+    ::testing::Values(MEM_POLICY_SEGREGATED, MEM_POLICY_FIRST_FIT, MEM_POLICY_NEXT_FIT,
+                      MEM_POLICY_BEST_FIT, MEM_POLICY_BUDDY));
+
+// Leave holes of 256, 128 and 512 bytes, in that address order, separated by live blocks
+static void make_holes(void *holes[3]) {
+    size_t sizes[] = {256, 128, 512};
+    for (int i = 0; i < 3; i++) {
+        holes[i] = mem_alloc(sizes[i]);
+        mem_alloc(16);
+    }
+    for (int i = 0; i < 3; i++) mem_free(holes[i]);
+}
+
+TEST(PlacementTest, FirstFitTakesLowestHole) {
+    mem_config cfg{};
+    cfg.policy = MEM_POLICY_FIRST_FIT;
+    mem_init_config(&cfg);
+
+    void *holes[3];
+    make_holes(holes);
+    EXPECT_EQ(holes[0], mem_alloc(100));
+    mem_init();
+}
+
+TEST(PlacementTest, NextFitResumesAfterLastPlacement) {
+    mem_config cfg{};
+    cfg.policy = MEM_POLICY_NEXT_FIT;
+    mem_init_config(&cfg);
+
+    void *holes[3];
+    make_holes(holes);
+    // The last placement was the guard after the final hole, so the
+    // search carries on from there instead of restarting at the bottom
+    void *p = mem_alloc(200);
+    EXPECT_GT(p, holes[2]);
+    EXPECT_GT(mem_alloc(200), p);
+    mem_init();
+}
+
+TEST(PlacementTest, BestFitTakesTightestHole) {
+    mem_config cfg{};
+    cfg.policy = MEM_POLICY_BEST_FIT;
+    mem_init_config(&cfg);
+
+    void *holes[3];
+    make_holes(holes);
+    EXPECT_EQ(holes[1], mem_alloc(100));
+    EXPECT_EQ(holes[0], mem_alloc(200));
+    mem_init();
+}
+
+TEST(PlacementTest, BuddyBlocksArePowersOfTwo) {
+    mem_config cfg{};
+    cfg.policy = MEM_POLICY_BUDDY;
+    mem_init_config(&cfg);
+
+    // 100 bytes plus the header round up to a 256-byte block, so neighbours are 256 apart
+    uint8_t *a = (uint8_t*)mem_alloc(100);
+    uint8_t *b = (uint8_t*)mem_alloc(100);
+    EXPECT_EQ(256, b - a);
+
+    // Freeing both merges the buddies, so a 480-byte payload fits at a again
+    mem_free(a);
+    mem_free(b);
+    EXPECT_EQ(a, mem_alloc(480));
+    mem_init();
+}
+
+#ifdef MEM_STATS
+TEST(PlacementTest, BuddyFootprintFollowsAllocations) {
+    mem_config cfg{};
+    cfg.policy = MEM_POLICY_BUDDY;
+    mem_init_config(&cfg);
+
+    // Only the blocks handed out count, not the whole power-of-two region
+    mem_stats stats;
+    uint8_t *first = (uint8_t*)mem_alloc(100);
+    mem_alloc(100);
+    mem_get_stats(&stats);
+    EXPECT_EQ(512u, stats.committed);
+    EXPECT_EQ(512u, stats.peak_committed);
+
+    // 1 MiB plus the header takes the 2 MiB block above the first one
+    uint8_t *big = (uint8_t*)mem_alloc(1 << 20);
+    EXPECT_EQ(2 << 20, big - first);
+    mem_get_stats(&stats);
+    EXPECT_EQ(4u << 20, stats.committed);
+    mem_init();
+}
+#endif
@@ -0,0 +1,125 @@
+#include <gtest/gtest.h>
+#include <stdint.h>
+#include <cstring>
+#include <set>
+#include <vector>
+
+#include "pool.h"
+#include "memory_allocator.h"
+
+class PoolTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        mem_init();
+    }
+    void TearDown() override {}
+};
+
+TEST_F(PoolTest, AllocDistinctObjects) {
+    pool *p = pool_create(24, 0);
+    ASSERT_NE(nullptr, p);
+
+    std::set<void*> seen;
+    for (int i = 0; i < 100; i++) {
+        void *obj = pool_alloc(p);
+        ASSERT_NE(nullptr, obj);
+        EXPECT_EQ(0u, (uintptr_t)obj % 16);
+        EXPECT_TRUE(seen.insert(obj).second);
+    }
+
+    // Objects of one slab are packed back to back
+    std::vector<uint8_t*> sorted;
+    for (void *obj : seen) sorted.push_back((uint8_t*)obj);
+    EXPECT_EQ(32, sorted[1] - sorted[0]);
+
+    pool_destroy(p);
+}
+
+TEST_F(PoolTest, FreedObjectIsReused) {
+    pool *p = pool_create(48, 0);
+    void *a = pool_alloc(p);
+    void *b = pool_alloc(p);
+    pool_free(p, a);
+    EXPECT_EQ(a, pool_alloc(p));
+    pool_free(p, b);
+    pool_destroy(p);
+}
+
+TEST_F(PoolTest, CustomAlignment) {
+    pool *p = pool_create(10, 64);
+    ASSERT_NE(nullptr, p);
+    for (int i = 0; i < 50; i++) {
+        void *obj = pool_alloc(p);
+        ASSERT_NE(nullptr, obj);
+        EXPECT_EQ(0u, (uintptr_t)obj % 64);
+    }
+    pool_destroy(p);
+
+    EXPECT_EQ(nullptr, pool_create(10, 24));
+}
+
+TEST_F(PoolTest, ManySlabsIntegrity) {
+    pool *p = pool_create(64, 0);
+    std::vector<uint8_t*> objs;
+
+    // Enough objects to fill many slabs
+    for (int i = 0; i < 20000; i++) {
+        uint8_t *obj = (uint8_t*)pool_alloc(p);
+        ASSERT_NE(nullptr, obj);
+        memset(obj, i & 0xFF, 64);
+        objs.push_back(obj);
+    }
+
+    // Free every other object, then refill the holes
+    for (size_t i = 0; i < objs.size(); i += 2) {
+        pool_free(p, objs[i]);
+    }
+    for (size_t i = 0; i < objs.size(); i += 2) {
+        objs[i] = (uint8_t*)pool_alloc(p);
+        ASSERT_NE(nullptr, objs[i]);
+        memset(objs[i], i & 0xFF, 64);
+    }
+
+    for (size_t i = 0; i < objs.size(); i++) {
+        EXPECT_EQ(i & 0xFF, objs[i][0]);
+        EXPECT_EQ(i & 0xFF, objs[i][63]);
+    }
+
+    for (uint8_t *obj : objs) {
+        pool_free(p, obj);
+    }
+    pool_destroy(p);
+
+    // Every slab went back to the heap
+    void *whole = mem_alloc((1 << 30) - 4096);
+    EXPECT_NE(nullptr, whole);
+    mem_free(whole);
+}
+
+TEST_F(PoolTest, LargeObjects) {
+    pool *p = pool_create(20000, 0);
+    ASSERT_NE(nullptr, p);
+    std::vector<void*> objs;
+    for (int i = 0; i < 20; i++) {
+        void *obj = pool_alloc(p);
+        ASSERT_NE(nullptr, obj);
+        memset(obj, 0x3C, 20000);
+        objs.push_back(obj);
+    }
+    for (void *obj : objs) pool_free(p, obj);
+    pool_destroy(p);
+}
+
+TEST_F(PoolTest, OverflowingSizesAreRejected) {
+    // The slab size computation would wrap for each of these
+    EXPECT_EQ(nullptr, pool_create((1ull << 61) + 16, 0));
+    EXPECT_EQ(nullptr, pool_create(SIZE_MAX, 0));
+    EXPECT_EQ(nullptr, pool_create(SIZE_MAX - 8, 16));
+    EXPECT_EQ(nullptr, pool_create(64, (size_t)1 << 63));
+
+    // Objects too large for the heap still give a pool, just no objects
+    pool *p = pool_create((size_t)1 << 40, 0);
+    ASSERT_NE(nullptr, p);
+    EXPECT_EQ(nullptr, pool_alloc(p));
+    pool_destroy(p);
+}
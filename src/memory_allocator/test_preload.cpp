@@ -0,0 +1,133 @@
+#include <gtest/gtest.h>
+#include <dlfcn.h>
+#include <malloc.h>
+#include <spawn.h>
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char **environ;
+
+// Runs argv with the allocator preloaded and returns its exit status
+static int run_preloaded(std::vector<const char*> argv) {
+    std::vector<std::string> env;
+    for (char **e = environ; *e; e++) {
+        if (strncmp(*e, "LD_PRELOAD=", 11) != 0) env.push_back(*e);
+    }
+    env.push_back(std::string("LD_PRELOAD=") + MEM_PRELOAD_LIB);
+    env.push_back("MEM_PRELOAD_CHILD=1");
+    std::vector<char*> envp;
+    for (auto &e : env) envp.push_back(&e[0]);
+    envp.push_back(nullptr);
+    argv.push_back(nullptr);
+
+    pid_t pid;
+    if (posix_spawn(&pid, argv[0], nullptr, nullptr, (char**)argv.data(), envp.data()) != 0) return -1;
+    int status;
+    if (waitpid(pid, &status, 0) != pid) return -1;
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
+
+TEST(PreloadTest, RunsShellPipeline) {
+    EXPECT_EQ(0, run_preloaded({"/bin/sh", "-c", "ls -lR /usr/include | sort -r | uniq -c > /dev/null"}));
+}
+
+TEST(PreloadTest, PreloadedProcessPasses) {
+    // Re-run this binary's PreloadedProcess tests, this time on top of the allocator
+    EXPECT_EQ(0, run_preloaded({"/proc/self/exe", "--gtest_filter=PreloadedProcess.*"}));
+}
+
+// The tests below only run inside the preloaded child
+class PreloadedProcess : public ::testing::Test {
+protected:
+    void SetUp() override {
+        if (!getenv("MEM_PRELOAD_CHILD")) GTEST_SKIP() << "only runs under LD_PRELOAD";
+    }
+};
+
+TEST_F(PreloadedProcess, MallocFamilyIsInterposed) {
+    ASSERT_NE(nullptr, dlsym(RTLD_DEFAULT, "mem_alloc"));
+
+    // The allocator rounds requests to 16 bytes, glibc to 8 past a multiple of 16
+    void *p = malloc(100);
+    ASSERT_NE(nullptr, p);
+    EXPECT_EQ(112u, malloc_usable_size(p));
+
+    p = realloc(p, 10000);
+    ASSERT_NE(nullptr, p);
+    EXPECT_GE(malloc_usable_size(p), 10000u);
+    free(p);
+
+    uint8_t *zeroed = (uint8_t*)calloc(1000, 4);
+    ASSERT_NE(nullptr, zeroed);
+    for (int i = 0; i < 4000; i++) ASSERT_EQ(0, zeroed[i]);
+    free(zeroed);
+    EXPECT_EQ(nullptr, calloc(SIZE_MAX / 2, 4));
+
+    void *aligned = nullptr;
+    EXPECT_EQ(0, posix_memalign(&aligned, 4096, 100));
+    EXPECT_EQ(0u, (uintptr_t)aligned % 4096);
+    free(aligned);
+    EXPECT_EQ(EINVAL, posix_memalign(&aligned, 12, 100));
+
+    aligned = aligned_alloc(256, 512);
+    ASSERT_NE(nullptr, aligned);
+    EXPECT_EQ(0u, (uintptr_t)aligned % 256);
+    free(aligned);
+
+    std::vector<std::string> strings(1000, std::string(100, 'x'));
+    EXPECT_EQ('x', strings[999][99]);
+}
+
+TEST_F(PreloadedProcess, ForkWhileThreadsAllocate) {
+    std::atomic<bool> stop{false};
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++) {
+        threads.emplace_back([&stop, t]() {
+            std::vector<void*> live;
+            for (unsigned i = 0; !stop.load(std::memory_order_relaxed); i++) {
+                live.push_back(malloc(16 + (i * 37 + t) % 4000));
+                if (live.size() > 100) {
+                    free(live[i % live.size()]);
+                    live[i % live.size()] = live.back();
+                    live.pop_back();
+                }
+            }
+            for (void *p : live) free(p);
+        });
+    }
+
+    // A child forked mid-allocation must still be able to allocate
+    for (int i = 0; i < 50; i++) {
+        pid_t pid = fork();
+        ASSERT_GE(pid, 0);
+        if (pid == 0) {
+            void *p = malloc(1000);
+            free(p);
+            _exit(p ? 0 : 1);
+        }
+
+        int status = 0;
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+        while (waitpid(pid, &status, WNOHANG) == 0) {
+            if (std::chrono::steady_clock::now() > deadline) {
+                kill(pid, SIGKILL);
+                waitpid(pid, &status, 0);
+                ADD_FAILURE() << "child " << i << " deadlocked";
+                break;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        EXPECT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0) << "child " << i;
+    }
+
+    stop = true;
+    for (auto &th : threads) th.join();
+}
@@ -0,0 +1,382 @@
+/*
+Ring buffer benchmark suite
+  Measures ringbuf_t and prints the results as one JSON object on stdout, so
+  runs of different queue variants or machines can be compared by script:
+
+    single_thread  bytes/s of a write_to + read_from loop on one thread, per
+                   chunk size
+    ping_pong      round-trip latency of an 8-byte message bounced between two
+                   threads over a pair of rings, p50/p99/p999 in ns
+    throughput     bytes/s streamed from a producer to a consumer thread, per
+                   chunk size
+
+  The threaded tests run once per CPU pair class found in the topology under
+  /sys/devices/system/cpu: two hardware threads of one core (same_core), two
+  cores of one package (same_socket, preferring cores that share a last-level
+  cache) and two packages (cross_socket), with a thread pinned to each CPU. Classes the machine or the affinity mask does not
+  offer are reported as null. Each test is run for every variant it applies
+  to: plain copies ("copy"), a mirrored buffer ("mirrored"), reserve/commit
+  ("zero_copy") and, for ping-pong, futex waits instead of spinning ("wait").
+
+  usage: ring_bench [bytes_per_run] [round_trips] [capacity]
+*/
+
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "ring_buffer.h"
+
+#define MAX_CHUNK (64 << 10)
+
+enum pair_class { SAME_CORE, SAME_SOCKET, CROSS_SOCKET, PAIR_CLASSES };
+
+static const char *pair_names[PAIR_CLASSES] = { "same_core", "same_socket", "cross_socket" };
+
+enum variant { COPY, MIRRORED, ZERO_COPY, WAIT };
+
+static const char *variant_names[] = { "copy", "mirrored", "zero_copy", "wait" };
+
+static const size_t chunk_sizes[] = { 8, 64, 512, 4096, MAX_CHUNK };
+#define NCHUNKS (sizeof(chunk_sizes) / sizeof(chunk_sizes[0]))
+
+typedef struct stream
+{
+    ringbuf_t *rb;
+    int cpu;
+    enum variant variant;
+    size_t chunk;
+    size_t total;
+    pthread_barrier_t *start;
+} stream;
+
+typedef struct pong
+{
+    ringbuf_t *ping;
+    ringbuf_t *pong;
+    int cpu;
+    enum variant variant;
+    size_t trips;
+    pthread_barrier_t *start;
+} pong;
+
+static uint8_t src_chunk[MAX_CHUNK], dst_chunk[MAX_CHUNK];
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void pin(int cpu)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+static long read_cpu_id(int cpu, const char *name)
+{
+    char path[128];
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/%s", cpu, name);
+    FILE *f = fopen(path, "r");
+    if (!f) return -1;
+    long value = -1;
+    if (fscanf(f, "%ld", &value) != 1) value = -1;
+    fclose(f);
+    return value;
+}
+
+// the first pair of usable CPUs in each class, -1 where there is none; for
+// same_socket the first pair sharing a last-level cache, if any does
+static void find_pairs(int pairs[PAIR_CLASSES][2])
+{
+    cpu_set_t allowed;
+    sched_getaffinity(0, sizeof(allowed), &allowed);
+
+    // read every usable CPU's ids once, then compare them pairwise
+    int cpus[CPU_SETSIZE];
+    long pkg[CPU_SETSIZE], core[CPU_SETSIZE], llc[CPU_SETSIZE];
+    int n = 0;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+    {
+        if (!CPU_ISSET(cpu, &allowed)) continue;
+        pkg[n] = read_cpu_id(cpu, "topology/physical_package_id");
+        if (pkg[n] < 0) continue;
+        core[n] = read_cpu_id(cpu, "topology/core_id");
+        // index3 is the L3, the last level on current x86 and arm64 servers
+        llc[n] = read_cpu_id(cpu, "cache/index3/id");
+        cpus[n++] = cpu;
+    }
+
+    for (int c = 0; c < PAIR_CLASSES; c++) pairs[c][0] = pairs[c][1] = -1;
+    int same_socket_shares_llc = 0;
+    for (int a = 0; a < n; a++)
+    {
+        for (int b = a + 1; b < n; b++)
+        {
+            int c = pkg[a] != pkg[b] ? CROSS_SOCKET : core[a] != core[b] ? SAME_SOCKET : SAME_CORE;
+            int shares_llc = llc[a] >= 0 && llc[a] == llc[b];
+            if (pairs[c][0] >= 0 && !(c == SAME_SOCKET && shares_llc && !same_socket_shares_llc)) continue;
+            pairs[c][0] = cpus[a];
+            pairs[c][1] = cpus[b];
+            if (c == SAME_SOCKET) same_socket_shares_llc = shares_llc;
+        }
+    }
+}
+
+static ringbuf_t *create(enum variant variant, size_t capacity)
+{
+    ringbuf_t *rb = variant == MIRRORED ? ringbuf_create_mirrored(capacity) : ringbuf_create(capacity);
+    if (!rb)
+    {
+        fprintf(stderr, "cannot create a %s ring of %zu bytes\n", variant_names[variant], capacity);
+        exit(1);
+    }
+    return rb;
+}
+
+static size_t produce(ringbuf_t *rb, enum variant variant, size_t chunk)
+{
+    if (variant != ZERO_COPY) return ringbuf_write_to(rb, src_chunk, chunk);
+
+    ringbuf_span spans[2];
+    ptrdiff_t n = ringbuf_reserve(rb, chunk, spans);
+    memset(spans[0].data, 0x5A, spans[0].len);
+    memset(spans[1].data, 0x5A, spans[1].len);
+    ringbuf_commit(rb, n);
+    return n;
+}
+
+static size_t consume(ringbuf_t *rb, enum variant variant, uint8_t *dst, size_t chunk, uint64_t *sum)
+{
+    if (variant != ZERO_COPY)
+    {
+        ptrdiff_t n = ringbuf_read_from(rb, dst, chunk);
+        if (n > 0) *sum += dst[0];
+        return n;
+    }
+
+    ringbuf_span spans[2];
+    ptrdiff_t n = ringbuf_peek(rb, spans);
+    if (n > (ptrdiff_t)chunk) n = chunk;
+    if (n > 0) *sum += spans[0].data[0];
+    ringbuf_consume(rb, n);
+    return n;
+}
+
+static double single_thread(enum variant variant, size_t chunk, size_t total, size_t capacity)
+{
+    ringbuf_t *rb = create(variant, capacity < chunk ? chunk : capacity);
+    uint64_t sum = 0;
+    double start = now_ns();
+    for (size_t moved = 0; moved < total; moved += chunk)
+    {
+        produce(rb, variant, chunk);
+        consume(rb, variant, dst_chunk, chunk, &sum);
+    }
+    double ns = now_ns() - start;
+    ringbuf_destroy(rb);
+    // keep the consumer's reads from being optimized away
+    if (sum == 1) fprintf(stderr, "\n");
+    return total / ns * 1e9;
+}
+
+static void *stream_producer(void *arg)
+{
+    stream *s = arg;
+    pin(s->cpu);
+    pthread_barrier_wait(s->start);
+    for (size_t sent = 0; sent < s->total;)
+    {
+        size_t want = s->total - sent < s->chunk ? s->total - sent : s->chunk;
+        sent += produce(s->rb, s->variant, want);
+    }
+    return NULL;
+}
+
+static double throughput(enum variant variant, const int cpus[2], size_t chunk, size_t total, size_t capacity)
+{
+    pthread_barrier_t start;
+    pthread_barrier_init(&start, NULL, 2);
+    stream s = { create(variant, capacity), cpus[0], variant, chunk, total, &start };
+    pthread_t producer;
+    pthread_create(&producer, NULL, stream_producer, &s);
+
+    pin(cpus[1]);
+    uint8_t *dst = malloc(chunk);
+    uint64_t sum = 0;
+    pthread_barrier_wait(&start);
+    double begin = now_ns();
+    for (size_t received = 0; received < total;) received += consume(s.rb, variant, dst, chunk, &sum);
+    double ns = now_ns() - begin;
+
+    pthread_join(producer, NULL);
+    pthread_barrier_destroy(&start);
+    free(dst);
+    ringbuf_destroy(s.rb);
+    if (sum == 1) fprintf(stderr, "\n");
+    return total / ns * 1e9;
+}
+
+// move one 8-byte message, spinning or waiting as the variant says
+static void send_msg(ringbuf_t *rb, enum variant variant, uint64_t msg)
+{
+    if (variant == WAIT) ringbuf_write_wait(rb, (const uint8_t *)&msg, sizeof(msg), -1);
+    else while (!ringbuf_write_to(rb, (const uint8_t *)&msg, sizeof(msg)));
+}
+
+static uint64_t recv_msg(ringbuf_t *rb, enum variant variant)
+{
+    uint64_t msg;
+    if (variant == WAIT) ringbuf_read_wait(rb, (uint8_t *)&msg, sizeof(msg), -1);
+    else while (!ringbuf_read_from(rb, (uint8_t *)&msg, sizeof(msg)));
+    return msg;
+}
+
+static void *ponger(void *arg)
+{
+    pong *p = arg;
+    pin(p->cpu);
+    pthread_barrier_wait(p->start);
+    for (size_t i = 0; i < p->trips; i++) send_msg(p->pong, p->variant, recv_msg(p->ping, p->variant));
+    return NULL;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static void ping_pong(enum variant variant, const int cpus[2], size_t trips, double pct[3])
+{
+    pthread_barrier_t start;
+    pthread_barrier_init(&start, NULL, 2);
+    pong p = { create(COPY, 64), create(COPY, 64), cpus[1], variant, trips, &start };
+    if (variant == WAIT)
+    {
+        ringbuf_set_blocking(p.ping);
+        ringbuf_set_blocking(p.pong);
+    }
+    pthread_t thread;
+    pthread_create(&thread, NULL, ponger, &p);
+
+    pin(cpus[0]);
+    double *rtt = malloc(trips * sizeof(double));
+    pthread_barrier_wait(&start);
+    for (size_t i = 0; i < trips; i++)
+    {
+        double begin = now_ns();
+        send_msg(p.ping, variant, i);
+        recv_msg(p.pong, variant);
+        rtt[i] = now_ns() - begin;
+    }
+    pthread_join(thread, NULL);
+
+    qsort(rtt, trips, sizeof(double), cmp_double);
+    pct[0] = rtt[trips * 50 / 100];
+    pct[1] = rtt[trips * 99 / 100];
+    pct[2] = rtt[trips * 999 / 1000];
+
+    free(rtt);
+    pthread_barrier_destroy(&start);
+    ringbuf_destroy(p.ping);
+    ringbuf_destroy(p.pong);
+}
+
+int main(int argc, char **argv)
+{
+    size_t total = argc > 1 ? strtoul(argv[1], NULL, 10) : 256 << 20;
+    size_t trips = argc > 2 ? strtoul(argv[2], NULL, 10) : 100000;
+    size_t capacity = argc > 3 ? strtoul(argv[3], NULL, 10) : 256 << 10;
+    if (!total) total = 1;
+    if (!trips) trips = 1;
+    if (!capacity) capacity = 1;
+
+    int pairs[PAIR_CLASSES][2];
+    find_pairs(pairs);
+
+    printf("{\n  \"bytes_per_run\": %zu,\n  \"round_trips\": %zu,\n  \"capacity\": %zu,\n", total, trips, capacity);
+
+    printf("  \"pairs\": {");
+    for (int c = 0; c < PAIR_CLASSES; c++)
+    {
+        printf("%s\"%s\": ", c ? ", " : "", pair_names[c]);
+        if (pairs[c][0] < 0) printf("null");
+        else printf("[%d, %d]", pairs[c][0], pairs[c][1]);
+    }
+    printf("},\n");
+
+    const char *sep = "";
+    printf("  \"single_thread\": [");
+    for (enum variant v = COPY; v <= ZERO_COPY; v++)
+    {
+        for (size_t i = 0; i < NCHUNKS; i++)
+        {
+            double rate = single_thread(v, chunk_sizes[i], total, capacity);
+            printf("%s\n    {\"variant\": \"%s\", \"chunk\": %zu, \"bytes_per_sec\": %.0f}", sep, variant_names[v],
+                   chunk_sizes[i], rate);
+            sep = ",";
+        }
+    }
+    printf("\n  ],\n");
+
+    static const enum variant pp_variants[] = { COPY, WAIT };
+    printf("  \"ping_pong\": {");
+    for (int c = 0; c < PAIR_CLASSES; c++)
+    {
+        printf("%s\n    \"%s\": ", c ? "," : "", pair_names[c]);
+        if (pairs[c][0] < 0)
+        {
+            printf("null");
+            continue;
+        }
+        sep = "";
+        printf("[");
+        for (size_t i = 0; i < sizeof(pp_variants) / sizeof(pp_variants[0]); i++)
+        {
+            double pct[3];
+            ping_pong(pp_variants[i], pairs[c], trips, pct);
+            printf("%s\n      {\"variant\": \"%s\", \"p50_ns\": %.0f, \"p99_ns\": %.0f, \"p999_ns\": %.0f}", sep,
+                   variant_names[pp_variants[i]], pct[0], pct[1], pct[2]);
+            sep = ",";
+        }
+        printf("\n    ]");
+    }
+    printf("\n  },\n");
+
+    printf("  \"throughput\": {");
+    for (int c = 0; c < PAIR_CLASSES; c++)
+    {
+        printf("%s\n    \"%s\": ", c ? "," : "", pair_names[c]);
+        if (pairs[c][0] < 0)
+        {
+            printf("null");
+            continue;
+        }
+        sep = "";
+        printf("[");
+        for (enum variant v = COPY; v <= ZERO_COPY; v++)
+        {
+            for (size_t i = 0; i < NCHUNKS; i++)
+            {
+                double rate = throughput(v, pairs[c], chunk_sizes[i], total, capacity);
+                printf("%s\n      {\"variant\": \"%s\", \"chunk\": %zu, \"bytes_per_sec\": %.0f}", sep,
+                       variant_names[v], chunk_sizes[i], rate);
+                sep = ",";
+            }
+        }
+        printf("\n    ]");
+    }
+    printf("\n  }\n}\n");
+    return 0;
+}
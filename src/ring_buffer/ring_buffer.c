@@ -1,58 +1,646 @@
+/*
+Ring buffer
+  A byte queue over a power-of-two sized array. Head and tail are free-running
+  counters that are only masked when they index the array, so tail - head is
+  the number of bytes queued and a full buffer needs no separate flag.
+
+  Reads and writes work out how much they can move up front and copy it with
+  at most two memcpy calls, one up to the end of the array and one from its
+  start, then advance the index once. The same two pieces are handed out
+  directly by ringbuf_reserve and ringbuf_peek, so a serializer can write into
+  the array and a parser read from it in place, then publish or release what
+  they used with ringbuf_commit or ringbuf_consume.
+
+  ringbuf_create_mirrored maps the pages of one memfd twice, back to back, so
+  buf[i] and buf[i + capacity] are the same byte. Any region up to capacity
+  then reads or writes as one contiguous span: split() never cuts it and a
+  record straddling the end of the array parses with plain pointer arithmetic.
+  Capacity is at least a page, as the mappings must be page aligned.
+
+  ringbuf_read_wait and ringbuf_write_wait block on a futex when there is
+  nothing to read or no room. A waiter spins briefly, then sets a parked flag
+  and sleeps; the other side only makes the wake syscall when it finds that
+  flag set, and clears it as it does, so a busy ring never enters the kernel
+  and a burst of updates wakes a parked waiter once. In eventfd mode the same
+  flag is armed by a read or write that comes up empty, and the next update
+  signals the eventfd instead, which an epoll loop can wait on. Checking the
+  flag takes a full fence after every update, so only rings put in blocking
+  mode, by ringbuf_set_blocking or by asking for an eventfd, do it; the rest
+  publish with a release store alone.
+
+  One thread may read while another writes. Each index is written by one side
+  only and published with a release store; the other side reads it with an
+  acquire load. The indices sit on separate cache lines, and each side keeps a
+  private copy of the other's index next to its own, only refreshing it when
+  that copy says there is not enough data or room. Most calls therefore touch
+  only their own side's line.
+
+  ringbuf_mpmc_t is a bounded queue of fixed-size elements for any number of
+  producers and consumers, after Dmitry Vyukov's design. Every slot carries a
+  sequence number. A slot at position pos is free for the producer that claims
+  pos when its sequence equals pos, and holds data for the consumer that claims
+  pos once it equals pos + 1; the consumer then sets it to pos + capacity,
+  freeing it for the next lap. Producers and consumers claim positions with a
+  compare-and-swap on their own counter and never touch the other side's, so
+  neither side takes a lock or waits on a thread that stalled mid-operation
+  elsewhere in the ring.
+*/
+
+#define _GNU_SOURCE
+
+#include <sched.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <linux/futex.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ring_buffer.h"
 
 #define BUF_SZ 256
+#define CACHE_LINE 64
+// reads of the other side's index before a waiter parks
+#define SPIN_TRIES 128
+
+// how a side waiting on the other one is parked
+enum { RUNNING, PARKED_FUTEX, ARMED_EVENTFD };
+
+struct waiter {
+    _Atomic uint32_t parked;
+    // futex word, bumped by every wakeup
+    _Atomic uint32_t seq;
+    // eventfd signalled instead, or -1
+    int fd;
+};
+
+struct ringbuf {
+    uint8_t *buf;
+    size_t mask;
+    // buf is followed by a second mapping of the same pages
+    int mirrored;
+    // a side may park, so every update has to check for it; fixed before the
+    // ring is shared
+    int blocking;
+
+    // consumer side: the read index and the consumer's last view of t
+    _Alignas(CACHE_LINE) _Atomic size_t h;
+    size_t t_cache;
 
-static struct {
-    uint8_t buf[BUF_SZ];
-    size_t h;
-    size_t t;
-    int full;
-} ringbuf = {
+    // producer side: the write index and the producer's last view of h
+    _Alignas(CACHE_LINE) _Atomic size_t t;
+    size_t h_cache;
+
+    // the consumer waiting for data and the producer waiting for room; apart
+    // from the index lines, since the other side checks them on every update
+    _Alignas(CACHE_LINE) struct waiter data_ready;
+    _Alignas(CACHE_LINE) struct waiter space_ready;
+};
+
+static uint8_t legacy_buf[BUF_SZ];
+
+static ringbuf_t ringbuf = {
+    .buf = legacy_buf,
+    .mask = BUF_SZ - 1,
     .h = 0,
     .t = 0,
-    .full = 0
+    .data_ready = { .fd = -1 },
+    .space_ready = { .fd = -1 }
 };
 
-int empty() {
-    return (!ringbuf.full && (ringbuf.h == ringbuf.t));
+static size_t round_up_pow2(size_t n)
+{
+    size_t cap = 1;
+    while (cap < n) cap <<= 1;
+    return cap;
 }
 
-int full() {
-    return ringbuf.full;
+static ringbuf_t *ringbuf_new(uint8_t *buf, size_t cap, int mirrored)
+{
+    // keep the two index lines from sharing a line with anything else
+    ringbuf_t *rb = aligned_alloc(CACHE_LINE, sizeof(*rb));
+    if (!rb) return NULL;
+    rb->buf = buf;
+    rb->mask = cap - 1;
+    rb->mirrored = mirrored;
+    rb->blocking = 0;
+    atomic_init(&rb->h, 0);
+    atomic_init(&rb->t, 0);
+    rb->t_cache = 0;
+    rb->h_cache = 0;
+    atomic_init(&rb->data_ready.parked, RUNNING);
+    atomic_init(&rb->data_ready.seq, 0);
+    rb->data_ready.fd = -1;
+    atomic_init(&rb->space_ready.parked, RUNNING);
+    atomic_init(&rb->space_ready.seq, 0);
+    rb->space_ready.fd = -1;
+    return rb;
 }
 
-// return number of bytes read, -1 on error
-int ringbuf_read(uint8_t *dst, size_t sz)
+ringbuf_t *ringbuf_create(size_t capacity)
 {
-    if (!dst) return -1;
+    if (!capacity || capacity > SIZE_MAX / 2 + 1) return NULL;
+
+    size_t cap = round_up_pow2(capacity);
+    uint8_t *buf = malloc(cap);
+    if (!buf) return NULL;
+    ringbuf_t *rb = ringbuf_new(buf, cap, 0);
+    if (!rb) free(buf);
+    return rb;
+}
 
-    size_t i = 0;
-    while (i < sz)
+ringbuf_t *ringbuf_create_mirrored(size_t capacity)
+{
+    size_t page = sysconf(_SC_PAGESIZE);
+    if (!capacity || capacity > SIZE_MAX / 4) return NULL;
+
+    size_t cap = round_up_pow2(capacity < page ? page : capacity);
+    int fd = memfd_create("ringbuf", MFD_CLOEXEC);
+    if (fd < 0) return NULL;
+    if (ftruncate(fd, cap) < 0)
     {
-        if (empty()) break;
+        close(fd);
+        return NULL;
+    }
 
-        dst[i] = ringbuf.buf[ringbuf.h];
-        ringbuf.h = (ringbuf.h + 1) & (BUF_SZ - 1);
-        ringbuf.full = 0;
-        i++;
+    // reserve both halves together so nothing else lands in between, then map
+    // the same pages over each
+    uint8_t *buf = mmap(NULL, 2 * cap, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buf == MAP_FAILED)
+    {
+        close(fd);
+        return NULL;
     }
-    return i;
+    int ok = mmap(buf, cap, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) != MAP_FAILED
+          && mmap(buf + cap, cap, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) != MAP_FAILED;
+    // the mappings keep the memory alive
+    close(fd);
+
+    ringbuf_t *rb = ok ? ringbuf_new(buf, cap, 1) : NULL;
+    if (!rb) munmap(buf, 2 * cap);
+    return rb;
 }
 
-// return number of bytes written, -1 on error
-int ringbuf_write(uint8_t *src, size_t sz)
+void ringbuf_destroy(ringbuf_t *rb)
+{
+    if (!rb) return;
+    if (rb->data_ready.fd >= 0) close(rb->data_ready.fd);
+    if (rb->space_ready.fd >= 0) close(rb->space_ready.fd);
+    if (rb->mirrored) munmap(rb->buf, 2 * ringbuf_capacity(rb));
+    else free(rb->buf);
+    free(rb);
+}
+
+size_t ringbuf_capacity(const ringbuf_t *rb)
+{
+    return rb->mask + 1;
+}
+
+size_t ringbuf_size(const ringbuf_t *rb)
+{
+    // read h first: t only moves forward, so the difference never goes negative
+    size_t h = atomic_load_explicit(&rb->h, memory_order_acquire);
+    return atomic_load_explicit(&rb->t, memory_order_acquire) - h;
+}
+
+int ringbuf_empty(const ringbuf_t *rb)
+{
+    return ringbuf_size(rb) == 0;
+}
+
+int ringbuf_full(const ringbuf_t *rb)
+{
+    return ringbuf_size(rb) == ringbuf_capacity(rb);
+}
+
+// bytes the consumer can read at h, looking at the producer's index only when
+// the cached view shows fewer than want
+static size_t readable(ringbuf_t *rb, size_t h, size_t want)
+{
+    size_t n = rb->t_cache - h;
+    if (n < want)
+    {
+        rb->t_cache = atomic_load_explicit(&rb->t, memory_order_acquire);
+        n = rb->t_cache - h;
+    }
+    return n;
+}
+
+static size_t writable(ringbuf_t *rb, size_t t, size_t want)
+{
+    size_t n = ringbuf_capacity(rb) - (t - rb->h_cache);
+    if (n < want)
+    {
+        rb->h_cache = atomic_load_explicit(&rb->h, memory_order_acquire);
+        n = ringbuf_capacity(rb) - (t - rb->h_cache);
+    }
+    return n;
+}
+
+// Called after publishing an index. The fence pairs with the one a waiter
+// issues after setting parked: either it sees the new index and does not sleep,
+// or this sees it parked. Only then is there a syscall, and it clears parked,
+// so everything published until the waiter parks again costs nothing more
+static void notify(const ringbuf_t *rb, struct waiter *w)
+{
+    // rings that never wait stay on plain release stores
+    if (!rb->blocking) return;
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&w->parked, memory_order_relaxed) == RUNNING) return;
+
+    uint32_t parked = atomic_exchange_explicit(&w->parked, RUNNING, memory_order_relaxed);
+    if (parked == PARKED_FUTEX)
+    {
+        atomic_fetch_add_explicit(&w->seq, 1, memory_order_release);
+        syscall(SYS_futex, &w->seq, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+    }
+    else if (parked == ARMED_EVENTFD)
+    {
+        uint64_t one = 1;
+        // only fails if the counter would overflow, and then it is readable anyway
+        (void)!write(w->fd, &one, sizeof(one));
+    }
+}
+
+// in eventfd mode a side that comes up empty-handed arms its fd, so the other
+// side signals it on the next update; 1 if that update already happened
+static int arm(ringbuf_t *rb, struct waiter *w, size_t (*avail)(ringbuf_t *, size_t, size_t), size_t idx)
+{
+    atomic_store_explicit(&w->parked, ARMED_EVENTFD, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    if (!avail(rb, idx, 1)) return 0;
+    atomic_store_explicit(&w->parked, RUNNING, memory_order_relaxed);
+    return 1;
+}
+
+static double now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+// wait until avail reports at least one byte at idx; 0 on timeout
+static int wait_for(ringbuf_t *rb, struct waiter *w, size_t (*avail)(ringbuf_t *, size_t, size_t), size_t idx,
+                    int timeout_ms)
+{
+    // under load the other side usually turns up sooner than a sleep and wakeup
+    for (int i = 0; i < SPIN_TRIES; i++)
+    {
+        if (avail(rb, idx, 1)) return 1;
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+    }
+
+    double deadline = now_ms() + timeout_ms;
+    for (;;)
+    {
+        uint32_t seq = atomic_load_explicit(&w->seq, memory_order_acquire);
+        atomic_store_explicit(&w->parked, PARKED_FUTEX, memory_order_relaxed);
+        atomic_thread_fence(memory_order_seq_cst);
+        if (avail(rb, idx, 1)) break;
+
+        struct timespec rel, *relp = NULL;
+        if (timeout_ms >= 0)
+        {
+            double left = deadline - now_ms();
+            if (left <= 0)
+            {
+                atomic_store_explicit(&w->parked, RUNNING, memory_order_relaxed);
+                return 0;
+            }
+            rel.tv_sec = left / 1e3;
+            rel.tv_nsec = (left - rel.tv_sec * 1e3) * 1e6;
+            relp = &rel;
+        }
+        // returns at once if a wakeup bumped seq since it was read
+        syscall(SYS_futex, &w->seq, FUTEX_WAIT_PRIVATE, seq, relp, NULL, 0);
+    }
+    atomic_store_explicit(&w->parked, RUNNING, memory_order_relaxed);
+    return 1;
+}
+
+// n bytes from index idx may wrap past the end of the array: up to the end,
+// then from the start. A mirrored buffer just runs on into the second mapping
+static void split(const ringbuf_t *rb, size_t idx, size_t n, ringbuf_span spans[2])
+{
+    size_t off = idx & rb->mask;
+    size_t first = ringbuf_capacity(rb) - off;
+    if (first > n || rb->mirrored) first = n;
+    spans[0] = (ringbuf_span){ rb->buf + off, first };
+    spans[1] = (ringbuf_span){ rb->buf, n - first };
+}
+
+ptrdiff_t ringbuf_peek(ringbuf_t *rb, ringbuf_span spans[2])
+{
+    if (!rb || !spans) return -1;
+
+    size_t h = atomic_load_explicit(&rb->h, memory_order_relaxed);
+    size_t n = readable(rb, h, SIZE_MAX);
+    if (!n && rb->data_ready.fd >= 0 && arm(rb, &rb->data_ready, readable, h)) n = readable(rb, h, SIZE_MAX);
+    split(rb, h, n, spans);
+    return n;
+}
+
+int ringbuf_consume(ringbuf_t *rb, size_t n)
+{
+    if (!rb) return -1;
+
+    size_t h = atomic_load_explicit(&rb->h, memory_order_relaxed);
+    if (readable(rb, h, n) < n) return -1;
+    atomic_store_explicit(&rb->h, h + n, memory_order_release);
+    if (n) notify(rb, &rb->space_ready);
+    return 0;
+}
+
+ptrdiff_t ringbuf_reserve(ringbuf_t *rb, size_t n, ringbuf_span spans[2])
+{
+    if (!rb || !spans) return -1;
+
+    size_t t = atomic_load_explicit(&rb->t, memory_order_relaxed);
+    size_t room = writable(rb, t, n);
+    if (!room && rb->space_ready.fd >= 0 && arm(rb, &rb->space_ready, writable, t)) room = writable(rb, t, n);
+    if (n > room) n = room;
+    split(rb, t, n, spans);
+    return n;
+}
+
+int ringbuf_commit(ringbuf_t *rb, size_t n)
+{
+    if (!rb) return -1;
+
+    size_t t = atomic_load_explicit(&rb->t, memory_order_relaxed);
+    if (writable(rb, t, n) < n) return -1;
+    atomic_store_explicit(&rb->t, t + n, memory_order_release);
+    if (n) notify(rb, &rb->data_ready);
+    return 0;
+}
+
+ptrdiff_t ringbuf_read_from(ringbuf_t *rb, uint8_t *dst, size_t sz)
+{
+    if (!rb || !dst) return -1;
+
+    size_t h = atomic_load_explicit(&rb->h, memory_order_relaxed);
+    size_t n = readable(rb, h, sz);
+    if (!n && sz && rb->data_ready.fd >= 0 && arm(rb, &rb->data_ready, readable, h)) n = readable(rb, h, sz);
+    if (n > sz) n = sz;
+
+    ringbuf_span spans[2];
+    split(rb, h, n, spans);
+    memcpy(dst, spans[0].data, spans[0].len);
+    memcpy(dst + spans[0].len, spans[1].data, spans[1].len);
+
+    atomic_store_explicit(&rb->h, h + n, memory_order_release);
+    if (n) notify(rb, &rb->space_ready);
+    return n;
+}
+
+ptrdiff_t ringbuf_write_to(ringbuf_t *rb, const uint8_t *src, size_t sz)
+{
+    if (!rb || !src) return -1;
+
+    size_t t = atomic_load_explicit(&rb->t, memory_order_relaxed);
+    size_t n = writable(rb, t, sz);
+    if (!n && sz && rb->space_ready.fd >= 0 && arm(rb, &rb->space_ready, writable, t)) n = writable(rb, t, sz);
+    if (n > sz) n = sz;
+
+    ringbuf_span spans[2];
+    split(rb, t, n, spans);
+    memcpy(spans[0].data, src, spans[0].len);
+    memcpy(spans[1].data, src + spans[0].len, spans[1].len);
+
+    atomic_store_explicit(&rb->t, t + n, memory_order_release);
+    if (n) notify(rb, &rb->data_ready);
+    return n;
+}
+
+ptrdiff_t ringbuf_read_wait(ringbuf_t *rb, uint8_t *dst, size_t sz, int timeout_ms)
+{
+    if (!rb || !dst || !rb->blocking) return -1;
+
+    size_t h = atomic_load_explicit(&rb->h, memory_order_relaxed);
+    if (sz && !wait_for(rb, &rb->data_ready, readable, h, timeout_ms)) return 0;
+    return ringbuf_read_from(rb, dst, sz);
+}
+
+ptrdiff_t ringbuf_write_wait(ringbuf_t *rb, const uint8_t *src, size_t sz, int timeout_ms)
+{
+    if (!rb || !src || !rb->blocking) return -1;
+
+    size_t t = atomic_load_explicit(&rb->t, memory_order_relaxed);
+    if (sz && !wait_for(rb, &rb->space_ready, writable, t, timeout_ms)) return 0;
+    return ringbuf_write_to(rb, src, sz);
+}
+
+int ringbuf_set_blocking(ringbuf_t *rb)
+{
+    if (!rb) return -1;
+    rb->blocking = 1;
+    return 0;
+}
+
+static int waiter_fd(ringbuf_t *rb, struct waiter *w)
+{
+    if (w->fd < 0) w->fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (w->fd >= 0) rb->blocking = 1;
+    return w->fd;
+}
+
+int ringbuf_readable_fd(ringbuf_t *rb)
+{
+    return rb ? waiter_fd(rb, &rb->data_ready) : -1;
+}
+
+int ringbuf_writable_fd(ringbuf_t *rb)
+{
+    return rb ? waiter_fd(rb, &rb->space_ready) : -1;
+}
+
+struct ringbuf_mpmc {
+    uint8_t *slots;
+    size_t mask;
+    size_t elem_size;
+    // sequence number followed by the element, padded to keep both aligned
+    size_t stride;
+
+    _Alignas(CACHE_LINE) _Atomic size_t enqueue_pos;
+    _Alignas(CACHE_LINE) _Atomic size_t dequeue_pos;
+};
+
+static _Atomic size_t *slot_seq(const ringbuf_mpmc_t *q, size_t pos)
+{
+    return (_Atomic size_t *)(q->slots + (pos & q->mask) * q->stride);
+}
+
+static uint8_t *slot_data(const ringbuf_mpmc_t *q, size_t pos)
+{
+    return q->slots + (pos & q->mask) * q->stride + sizeof(size_t);
+}
+
+ringbuf_mpmc_t *ringbuf_mpmc_create(size_t capacity, size_t elem_size)
+{
+    if (!capacity || !elem_size || capacity > SIZE_MAX / 2 + 1) return NULL;
+
+    size_t cap = 1;
+    while (cap < capacity) cap <<= 1;
+
+    size_t align = _Alignof(max_align_t);
+    size_t stride = (sizeof(size_t) + elem_size + align - 1) & ~(align - 1);
+    if (stride < elem_size || cap > SIZE_MAX / stride) return NULL;
+
+    ringbuf_mpmc_t *q = aligned_alloc(CACHE_LINE, sizeof(*q));
+    if (!q) return NULL;
+    q->slots = malloc(cap * stride);
+    if (!q->slots)
+    {
+        free(q);
+        return NULL;
+    }
+    q->mask = cap - 1;
+    q->elem_size = elem_size;
+    q->stride = stride;
+    for (size_t i = 0; i < cap; i++) atomic_init(slot_seq(q, i), i);
+    atomic_init(&q->enqueue_pos, 0);
+    atomic_init(&q->dequeue_pos, 0);
+    return q;
+}
+
+void ringbuf_mpmc_destroy(ringbuf_mpmc_t *q)
 {
-    if (!src) return -1;
-    size_t i = 0;
-    while (i < sz) {
-        if (full()) break;
+    if (!q) return;
+    free(q->slots);
+    free(q);
+}
 
-        ringbuf.buf[ringbuf.t] = src[i];
-        ringbuf.t = (ringbuf.t + 1) & (BUF_SZ - 1);
-        if (ringbuf.t == ringbuf.h) ringbuf.full = 1;
-        i++;
+size_t ringbuf_mpmc_capacity(const ringbuf_mpmc_t *q)
+{
+    return q->mask + 1;
+}
+
+size_t ringbuf_mpmc_elem_size(const ringbuf_mpmc_t *q)
+{
+    return q->elem_size;
+}
+
+int ringbuf_mpmc_try_enqueue(ringbuf_mpmc_t *q, const void *src)
+{
+    if (!q || !src) return -1;
+
+    size_t pos = atomic_load_explicit(&q->enqueue_pos, memory_order_relaxed);
+    for (;;)
+    {
+        size_t seq = atomic_load_explicit(slot_seq(q, pos), memory_order_acquire);
+        ptrdiff_t diff = (ptrdiff_t)(seq - pos);
+        if (diff == 0)
+        {
+            // the slot is free on this lap, claim it; on failure pos is reloaded
+            if (atomic_compare_exchange_weak_explicit(&q->enqueue_pos, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed))
+                break;
+        }
+        else if (diff < 0)
+        {
+            // still holds last lap's element: full
+            return 0;
+        }
+        else
+        {
+            // another producer claimed it first
+            pos = atomic_load_explicit(&q->enqueue_pos, memory_order_relaxed);
+        }
     }
-    return i;
-}
\ No newline at end of file
+
+    memcpy(slot_data(q, pos), src, q->elem_size);
+    atomic_store_explicit(slot_seq(q, pos), pos + 1, memory_order_release);
+    return 1;
+}
+
+int ringbuf_mpmc_try_dequeue(ringbuf_mpmc_t *q, void *dst)
+{
+    if (!q || !dst) return -1;
+
+    size_t pos = atomic_load_explicit(&q->dequeue_pos, memory_order_relaxed);
+    for (;;)
+    {
+        size_t seq = atomic_load_explicit(slot_seq(q, pos), memory_order_acquire);
+        ptrdiff_t diff = (ptrdiff_t)(seq - (pos + 1));
+        if (diff == 0)
+        {
+            if (atomic_compare_exchange_weak_explicit(&q->dequeue_pos, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed))
+                break;
+        }
+        else if (diff < 0)
+        {
+            // not written yet on this lap: empty
+            return 0;
+        }
+        else
+        {
+            pos = atomic_load_explicit(&q->dequeue_pos, memory_order_relaxed);
+        }
+    }
+
+    memcpy(dst, slot_data(q, pos), q->elem_size);
+    atomic_store_explicit(slot_seq(q, pos), pos + q->mask + 1, memory_order_release);
+    return 1;
+}
+
+// spin briefly, then give the CPU to whoever has to make progress first
+static void backoff(unsigned *spins)
+{
+    if (*spins < 64)
+    {
+        (*spins)++;
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+    }
+    else
+    {
+        sched_yield();
+    }
+}
+
+int ringbuf_mpmc_enqueue(ringbuf_mpmc_t *q, const void *src)
+{
+    unsigned spins = 0;
+    int ret;
+    while (!(ret = ringbuf_mpmc_try_enqueue(q, src))) backoff(&spins);
+    return ret;
+}
+
+int ringbuf_mpmc_dequeue(ringbuf_mpmc_t *q, void *dst)
+{
+    unsigned spins = 0;
+    int ret;
+    while (!(ret = ringbuf_mpmc_try_dequeue(q, dst))) backoff(&spins);
+    return ret;
+}
+
+int empty() {
+    return ringbuf_empty(&ringbuf);
+}
+
+int full() {
+    return ringbuf_full(&ringbuf);
+}
+
+// return number of bytes read, -1 on error
+int ringbuf_read(uint8_t *dst, size_t sz)
+{
+    return ringbuf_read_from(&ringbuf, dst, sz);
+}
+
+// return number of bytes written, -1 on error
+int ringbuf_write(uint8_t *src, size_t sz)
+{
+    return ringbuf_write_to(&ringbuf, src, sz);
+}
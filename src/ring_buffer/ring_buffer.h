@@ -0,0 +1,99 @@
+#ifndef RING_BUFFER_H
+#define RING_BUFFER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// One thread may read while another writes to the same buffer without locking;
+// more than one reader or more than one writer needs outside synchronization
+typedef struct ringbuf ringbuf_t;
+
+// capacity is rounded up to a power of two; NULL if it is 0 or too large
+ringbuf_t *ringbuf_create(size_t capacity);
+// same, but with the array mapped twice in a row so no readable or writable
+// region ever wraps: every span below comes back in one piece. capacity is
+// also rounded up to at least a page; NULL if memfd/mmap fail
+ringbuf_t *ringbuf_create_mirrored(size_t capacity);
+void ringbuf_destroy(ringbuf_t *rb);
+
+// return number of bytes read/written, -1 on error
+ptrdiff_t ringbuf_read_from(ringbuf_t *rb, uint8_t *dst, size_t sz);
+ptrdiff_t ringbuf_write_to(ringbuf_t *rb, const uint8_t *src, size_t sz);
+
+// Zero-copy access. A region of the buffer may wrap past the end of its array,
+// so it comes as two spans in order, the second empty when it does not wrap.
+// The spans stay valid until the matching commit/consume; only the producer
+// may reserve and commit, only the consumer may peek and consume
+typedef struct ringbuf_span
+{
+    uint8_t *data;
+    size_t len;
+} ringbuf_span;
+
+// up to n bytes of free space to fill; returns how many, -1 on error
+ptrdiff_t ringbuf_reserve(ringbuf_t *rb, size_t n, ringbuf_span spans[2]);
+// publish the first n reserved bytes to the consumer; -1 if n exceeds the free space
+int ringbuf_commit(ringbuf_t *rb, size_t n);
+// everything waiting to be read; returns how many bytes, -1 on error
+ptrdiff_t ringbuf_peek(ringbuf_t *rb, ringbuf_span spans[2]);
+// release the first n peeked bytes back to the producer; -1 if fewer are queued
+int ringbuf_consume(ringbuf_t *rb, size_t n);
+
+// Blocking mode lets either side wait for the other, at the cost of a full
+// fence on every update. Set it before the ring is shared; -1 on error
+int ringbuf_set_blocking(ringbuf_t *rb);
+
+// Like read_from/write_to, but first wait until at least one byte can be read
+// or written, for up to timeout_ms (-1 waits forever). 0 on timeout, -1 on
+// error, including a ring not in blocking mode
+ptrdiff_t ringbuf_read_wait(ringbuf_t *rb, uint8_t *dst, size_t sz, int timeout_ms);
+ptrdiff_t ringbuf_write_wait(ringbuf_t *rb, const uint8_t *src, size_t sz, int timeout_ms);
+
+// Eventfd mode, for plugging a ring into an epoll loop: the fd becomes readable
+// once the ring may have data (readable_fd) or room (writable_fd). It is armed
+// by a read/peek (write/reserve) that comes back with nothing, so drain the fd
+// and then the ring until that happens before waiting again. Puts the ring in
+// blocking mode, so set it up before other threads use the ring; closed by
+// ringbuf_destroy. -1 on error
+int ringbuf_readable_fd(ringbuf_t *rb);
+int ringbuf_writable_fd(ringbuf_t *rb);
+
+int ringbuf_empty(const ringbuf_t *rb);
+int ringbuf_full(const ringbuf_t *rb);
+// bytes waiting to be read
+size_t ringbuf_size(const ringbuf_t *rb);
+size_t ringbuf_capacity(const ringbuf_t *rb);
+
+// Bounded queue of elem_size-byte elements, safe for any number of producer
+// and consumer threads. Elements come out in the order their enqueue claimed a
+// slot. capacity is rounded up to a power of two; NULL if it or elem_size is 0
+typedef struct ringbuf_mpmc ringbuf_mpmc_t;
+
+ringbuf_mpmc_t *ringbuf_mpmc_create(size_t capacity, size_t elem_size);
+void ringbuf_mpmc_destroy(ringbuf_mpmc_t *q);
+size_t ringbuf_mpmc_capacity(const ringbuf_mpmc_t *q);
+size_t ringbuf_mpmc_elem_size(const ringbuf_mpmc_t *q);
+
+// copy one element in or out; return 1 on success, 0 if the queue is
+// full/empty, -1 on error
+int ringbuf_mpmc_try_enqueue(ringbuf_mpmc_t *q, const void *src);
+int ringbuf_mpmc_try_dequeue(ringbuf_mpmc_t *q, void *dst);
+// wait, spinning then yielding, until there is room/an element; 1 or -1
+int ringbuf_mpmc_enqueue(ringbuf_mpmc_t *q, const void *src);
+int ringbuf_mpmc_dequeue(ringbuf_mpmc_t *q, void *dst);
+
+// the original single 256-byte buffer, kept on top of a static instance
+int empty();
+int full();
+int ringbuf_read(uint8_t *dst, size_t sz);
+int ringbuf_write(uint8_t *src, size_t sz);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
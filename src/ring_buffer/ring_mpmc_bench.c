@@ -0,0 +1,128 @@
+/*
+MPMC queue scaling benchmark
+  Runs k producers and k consumers against one ringbuf_mpmc_t for k = 1, 2,
+  4, ... and finally max_threads, each producer pushing a fixed number of
+  8-byte elements, and prints the combined throughput. The consumers add up
+  what they take out and the sum is checked, so a lost or duplicated element
+  shows up as a failure rather than a fast run.
+
+  usage: ring_mpmc_bench [max_threads] [items_per_producer] [capacity]
+
+  max_threads defaults to the number of online CPUs. With more threads than
+  CPUs the blocking calls fall back to sched_yield, so the numbers then show
+  oversubscription as much as queue contention.
+*/
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ring_buffer.h"
+
+typedef struct worker
+{
+    pthread_t thread;
+    ringbuf_mpmc_t *q;
+    pthread_barrier_t *start;
+    size_t items;
+    uint64_t first;
+    uint64_t sum;
+} worker;
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void *produce(void *arg)
+{
+    worker *w = arg;
+    pthread_barrier_wait(w->start);
+    for (uint64_t i = 0; i < w->items; i++)
+    {
+        uint64_t value = w->first + i;
+        ringbuf_mpmc_enqueue(w->q, &value);
+    }
+    return NULL;
+}
+
+static void *consume(void *arg)
+{
+    worker *w = arg;
+    pthread_barrier_wait(w->start);
+    for (size_t i = 0; i < w->items; i++)
+    {
+        uint64_t value;
+        ringbuf_mpmc_dequeue(w->q, &value);
+        w->sum += value;
+    }
+    return NULL;
+}
+
+// k producers and k consumers move k * items elements, each consumer taking
+// an equal share; returns 0 if the consumers' sum is off
+static int run(size_t k, size_t items, size_t capacity)
+{
+    ringbuf_mpmc_t *q = ringbuf_mpmc_create(capacity, sizeof(uint64_t));
+    if (!q)
+    {
+        fprintf(stderr, "cannot create a queue of %zu elements\n", capacity);
+        exit(1);
+    }
+    worker *workers = calloc(2 * k, sizeof(worker));
+    pthread_barrier_t start;
+    pthread_barrier_init(&start, NULL, 2 * k + 1);
+
+    for (size_t i = 0; i < 2 * k; i++)
+    {
+        workers[i].q = q;
+        workers[i].start = &start;
+        workers[i].items = items;
+        workers[i].first = i * items;
+        pthread_create(&workers[i].thread, NULL, i < k ? produce : consume, &workers[i]);
+    }
+
+    pthread_barrier_wait(&start);
+    double begin = now_ns();
+    uint64_t sum = 0;
+    for (size_t i = 0; i < 2 * k; i++)
+    {
+        pthread_join(workers[i].thread, NULL);
+        sum += workers[i].sum;
+    }
+    double ns = now_ns() - begin;
+
+    // the producers pushed 0 .. k * items - 1 between them
+    uint64_t total = (uint64_t)k * items;
+    uint64_t expected = total * (total - 1) / 2;
+    printf("%4zu x %-4zu %10.2f Mops/s  %8.1f ns/op  %s\n", k, k, total / ns * 1e3, ns / total,
+           sum == expected ? "ok" : "CHECKSUM MISMATCH");
+
+    pthread_barrier_destroy(&start);
+    free(workers);
+    ringbuf_mpmc_destroy(q);
+    return sum == expected;
+}
+
+int main(int argc, char **argv)
+{
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t max_threads = argc > 1 ? strtoul(argv[1], NULL, 10) : (size_t)(cpus > 0 ? cpus : 1);
+    size_t items = argc > 2 ? strtoul(argv[2], NULL, 10) : 1 << 20;
+    size_t capacity = argc > 3 ? strtoul(argv[3], NULL, 10) : 1024;
+    if (!max_threads) max_threads = 1;
+    if (!items) items = 1;
+
+    printf("producers x consumers, %zu items each, capacity %zu\n", items, capacity);
+    int ok = 1;
+    size_t k = 1;
+    for (; k <= max_threads; k *= 2) ok &= run(k, items, capacity);
+    // finish the sweep at max_threads when it is not a power of two
+    if (k / 2 != max_threads) ok &= run(max_threads, items, capacity);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,166 @@
+#ifndef RING_QUEUE_HPP
+#define RING_QUEUE_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <new>
+#include <optional>
+#include <type_traits>
+#include <utility>
+
+/*
+Typed ring queue
+  RingQueue<T, Capacity> keeps up to Capacity objects of type T constructed in
+  place in its own storage, for record-oriented pipelines that would otherwise
+  serialize structs through the byte-oriented ringbuf_t. Capacity must be a
+  power of two, so wrapping an index is an AND with a compile-time mask.
+
+  It follows ringbuf_t's concurrency contract: one thread may push while
+  another pops. Head and tail are free-running counters on their own cache
+  lines, published with release stores, and each side caches the other's
+  index, reloading it only when the cached view shows too little room or data.
+
+  T must be move constructible. try_pop(T &) and pop_n hand elements out by
+  move assignment, so they also need T to be move assignable, and pop_n needs
+  dst to already hold constructed objects. push_n/pop_n move whole batches and
+  publish them with a single index update; if a move throws partway through,
+  the elements moved so far are published before the exception propagates.
+*/
+template <typename T, std::size_t Capacity>
+class RingQueue {
+    static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0,
+                  "RingQueue capacity must be a power of two");
+    static_assert(std::is_move_constructible<T>::value,
+                  "RingQueue elements must be move constructible");
+
+public:
+    RingQueue() = default;
+    RingQueue(const RingQueue &) = delete;
+    RingQueue &operator=(const RingQueue &) = delete;
+
+    ~RingQueue() {
+        std::size_t t = tail_.load(std::memory_order_relaxed);
+        for (std::size_t h = head_.load(std::memory_order_relaxed); h != t; h++) slot(h)->~T();
+    }
+
+    static constexpr std::size_t capacity() { return Capacity; }
+
+    std::size_t size() const {
+        // read head first: tail only moves forward, so the difference never goes negative
+        std::size_t h = head_.load(std::memory_order_acquire);
+        return tail_.load(std::memory_order_acquire) - h;
+    }
+    bool empty() const { return size() == 0; }
+    bool full() const { return size() == Capacity; }
+
+    // construct an element in place from args; false if the queue is full
+    template <typename... Args>
+    bool try_emplace(Args &&...args) {
+        std::size_t t = tail_.load(std::memory_order_relaxed);
+        if (writable(t, 1) == 0) return false;
+        ::new (static_cast<void *>(slot(t))) T(std::forward<Args>(args)...);
+        tail_.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool try_push(const T &value) { return try_emplace(value); }
+    bool try_push(T &&value) { return try_emplace(std::move(value)); }
+
+    // move the front element out; empty if there is none
+    std::optional<T> try_pop() {
+        std::size_t h = head_.load(std::memory_order_relaxed);
+        if (readable(h, 1) == 0) return std::nullopt;
+        std::optional<T> value(std::move(*slot(h)));
+        slot(h)->~T();
+        head_.store(h + 1, std::memory_order_release);
+        return value;
+    }
+
+    bool try_pop(T &out) {
+        std::size_t h = head_.load(std::memory_order_relaxed);
+        if (readable(h, 1) == 0) return false;
+        out = std::move(*slot(h));
+        slot(h)->~T();
+        head_.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    // move up to n elements in from src; returns how many fit. src[i] is left
+    // moved-from for every i below the returned count. If constructing element
+    // i throws, elements 0 .. i-1 stay queued
+    std::size_t push_n(T *src, std::size_t n) {
+        std::size_t t = tail_.load(std::memory_order_relaxed);
+        std::size_t room = writable(t, n);
+        if (n > room) n = room;
+        std::size_t i = 0;
+        try {
+            for (; i < n; i++) ::new (static_cast<void *>(slot(t + i))) T(std::move(src[i]));
+        } catch (...) {
+            tail_.store(t + i, std::memory_order_release);
+            throw;
+        }
+        tail_.store(t + n, std::memory_order_release);
+        return n;
+    }
+
+    // move-assign up to n elements out into dst; returns how many there were.
+    // If assigning dst[i] throws, dst[0 .. i-1] are taken and element i is
+    // still at the front of the queue
+    std::size_t pop_n(T *dst, std::size_t n) {
+        std::size_t h = head_.load(std::memory_order_relaxed);
+        std::size_t avail = readable(h, n);
+        if (n > avail) n = avail;
+        std::size_t i = 0;
+        try {
+            for (; i < n; i++) {
+                dst[i] = std::move(*slot(h + i));
+                slot(h + i)->~T();
+            }
+        } catch (...) {
+            head_.store(h + i, std::memory_order_release);
+            throw;
+        }
+        head_.store(h + n, std::memory_order_release);
+        return n;
+    }
+
+private:
+    static constexpr std::size_t kMask = Capacity - 1;
+    static constexpr std::size_t kCacheLine = 64;
+
+    T *slot(std::size_t idx) {
+        return std::launder(reinterpret_cast<T *>(storage_ + (idx & kMask) * sizeof(T)));
+    }
+
+    // elements the consumer can take at h, reloading tail only when the cached
+    // view shows fewer than want
+    std::size_t readable(std::size_t h, std::size_t want) {
+        std::size_t n = tail_cache_ - h;
+        if (n < want) {
+            tail_cache_ = tail_.load(std::memory_order_acquire);
+            n = tail_cache_ - h;
+        }
+        return n;
+    }
+
+    std::size_t writable(std::size_t t, std::size_t want) {
+        std::size_t n = Capacity - (t - head_cache_);
+        if (n < want) {
+            head_cache_ = head_.load(std::memory_order_acquire);
+            n = Capacity - (t - head_cache_);
+        }
+        return n;
+    }
+
+    alignas(T) unsigned char storage_[Capacity * sizeof(T)];
+
+    // consumer side
+    alignas(kCacheLine) std::atomic<std::size_t> head_{0};
+    std::size_t tail_cache_ = 0;
+
+    // producer side
+    alignas(kCacheLine) std::atomic<std::size_t> tail_{0};
+    std::size_t head_cache_ = 0;
+};
+
+#endif
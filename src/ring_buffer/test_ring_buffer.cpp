@@ -3,13 +3,14 @@
 #include <cstring>
 #include <vector>
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
 
-extern "C" {
-    int empty();
-    int full();
-    int ringbuf_read(uint8_t *dst, size_t sz);
-    int ringbuf_write(uint8_t *src, size_t sz);
-}
+#include <poll.h>
+#include <unistd.h>
+
+#include "ring_buffer.h"
 
 class RingBufferTest : public ::testing::Test {
 protected:
@@ -410,4 +411,457 @@ TEST_F(RingBufferTest, SequentialPattern) {
     // Verify the entire pattern
     EXPECT_EQ(0, memcmp(ringbuf_write_data, ringbuf_read_data, pattern_size));
     EXPECT_TRUE(isBufferEmpty());
-}
\ No newline at end of file
+}
+
+class RingBufferInstanceTest : public ::testing::Test {
+protected:
+    void TearDown() override {
+        for (ringbuf_t *rb : buffers) ringbuf_destroy(rb);
+    }
+
+    ringbuf_t *create(size_t capacity) {
+        ringbuf_t *rb = ringbuf_create(capacity);
+        if (rb) buffers.push_back(rb);
+        return rb;
+    }
+
+    std::vector<ringbuf_t*> buffers;
+};
+
+TEST_F(RingBufferInstanceTest, CapacityRoundsUpToPowerOfTwo) {
+    EXPECT_EQ(nullptr, ringbuf_create(0));
+    EXPECT_EQ(1u, ringbuf_capacity(create(1)));
+    EXPECT_EQ(8u, ringbuf_capacity(create(5)));
+    EXPECT_EQ(128u, ringbuf_capacity(create(100)));
+    EXPECT_EQ(4096u, ringbuf_capacity(create(4096)));
+}
+
+TEST_F(RingBufferInstanceTest, InstancesAreIndependent) {
+    ringbuf_t *a = create(16);
+    ringbuf_t *b = create(1000);
+    ASSERT_NE(nullptr, a);
+    ASSERT_NE(nullptr, b);
+
+    uint8_t data[1024];
+    for (int i = 0; i < 1024; i++) data[i] = i & 0xFF;
+    EXPECT_EQ(16, ringbuf_write_to(a, data, sizeof(data)));
+    EXPECT_EQ(1024, ringbuf_write_to(b, data, sizeof(data)));
+    EXPECT_TRUE(ringbuf_full(a));
+    EXPECT_TRUE(ringbuf_full(b));
+    EXPECT_EQ(1024u, ringbuf_size(b));
+
+    // The original global buffer is a separate queue again
+    EXPECT_TRUE(empty());
+
+    uint8_t out[1024];
+    EXPECT_EQ(16, ringbuf_read_from(a, out, sizeof(out)));
+    EXPECT_EQ(0, memcmp(data, out, 16));
+    EXPECT_TRUE(ringbuf_empty(a));
+    EXPECT_EQ(1024, ringbuf_read_from(b, out, sizeof(out)));
+    EXPECT_EQ(0, memcmp(data, out, 1024));
+}
+
+TEST_F(RingBufferInstanceTest, LargeCapacityWrapAround) {
+    const size_t capacity = 1 << 20;
+    ringbuf_t *rb = create(capacity);
+    ASSERT_NE(nullptr, rb);
+
+    // Odd-sized chunks walk the indices across the end of the array many times
+    std::vector<uint8_t> in(100003), out(100003);
+    size_t written = 0, read = 0;
+    while (read < 10 * capacity) {
+        for (size_t i = 0; i < in.size(); i++) in[i] = (written + i) * 31 & 0xFF;
+        ptrdiff_t n = ringbuf_write_to(rb, in.data(), in.size());
+        ASSERT_GT(n, 0);
+        // A short write only happens once the buffer is full; the next round
+        // regenerates the pattern from where it stopped
+        if ((size_t)n < in.size()) {
+            EXPECT_TRUE(ringbuf_full(rb));
+        }
+        written += n;
+
+        ptrdiff_t m = ringbuf_read_from(rb, out.data(), out.size() / 2);
+        for (ptrdiff_t i = 0; i < m; i++) {
+            ASSERT_EQ((uint8_t)((read + i) * 31), out[i]) << "byte " << read + i;
+        }
+        read += m;
+    }
+    EXPECT_EQ(written - read, ringbuf_size(rb));
+}
+
+TEST_F(RingBufferInstanceTest, SingleCallSpansTheWrap) {
+    ringbuf_t *rb = create(64);
+    uint8_t data[100], out[100];
+    for (int i = 0; i < 100; i++) data[i] = 100 + i;
+
+    // Move both indices close to the end of the array
+    EXPECT_EQ(50, ringbuf_write_to(rb, data, 50));
+    EXPECT_EQ(50, ringbuf_read_from(rb, out, 50));
+
+    // One call fills the 14 bytes up to the end and 50 more from the start
+    EXPECT_EQ(64, ringbuf_write_to(rb, data, sizeof(data)));
+    EXPECT_TRUE(ringbuf_full(rb));
+    EXPECT_EQ(64, ringbuf_read_from(rb, out, sizeof(out)));
+    EXPECT_EQ(0, memcmp(data, out, 64));
+    EXPECT_TRUE(ringbuf_empty(rb));
+}
+
+TEST_F(RingBufferInstanceTest, NullPointerHandling) {
+    ringbuf_t *rb = create(64);
+    uint8_t byte = 0;
+    EXPECT_EQ(-1, ringbuf_read_from(nullptr, &byte, 1));
+    EXPECT_EQ(-1, ringbuf_write_to(nullptr, &byte, 1));
+    EXPECT_EQ(-1, ringbuf_read_from(rb, nullptr, 1));
+    EXPECT_EQ(-1, ringbuf_write_to(rb, nullptr, 1));
+    ringbuf_destroy(nullptr);
+}
+
+TEST_F(RingBufferInstanceTest, ProducerConsumerThreads) {
+    ringbuf_t *rb = create(4096);
+    ASSERT_NE(nullptr, rb);
+
+    // Push far more than the capacity through in odd-sized chunks, so both
+    // sides keep running into a full or empty buffer and refresh their view
+    const size_t total = 64 << 20;
+    std::thread producer([rb, total] {
+        uint8_t chunk[777];
+        size_t sent = 0;
+        while (sent < total) {
+            size_t want = std::min(sizeof(chunk), total - sent);
+            for (size_t i = 0; i < want; i++) chunk[i] = (sent + i) * 7 & 0xFF;
+            ptrdiff_t n = ringbuf_write_to(rb, chunk, want);
+            if (n == 0) std::this_thread::yield();
+            sent += n;
+        }
+    });
+
+    uint8_t chunk[1000];
+    size_t received = 0;
+    bool intact = true;
+    while (received < total) {
+        ptrdiff_t n = ringbuf_read_from(rb, chunk, sizeof(chunk));
+        if (n == 0) std::this_thread::yield();
+        for (ptrdiff_t i = 0; i < n && intact; i++) {
+            intact = chunk[i] == (uint8_t)((received + i) * 7);
+        }
+        received += n;
+    }
+    producer.join();
+
+    EXPECT_TRUE(intact);
+    EXPECT_EQ(total, received);
+    EXPECT_TRUE(ringbuf_empty(rb));
+}
+
+TEST_F(RingBufferInstanceTest, ReserveAndPeekSpanTheWrap) {
+    ringbuf_t *rb = create(16);
+    ASSERT_NE(nullptr, rb);
+    ringbuf_span spans[2];
+
+    // Move both indices to 12 so the next region wraps after 4 bytes
+    ASSERT_EQ(12, ringbuf_reserve(rb, 12, spans));
+    EXPECT_EQ(0u, spans[1].len);
+    EXPECT_EQ(0, ringbuf_commit(rb, 12));
+    EXPECT_EQ(12, ringbuf_peek(rb, spans));
+    EXPECT_EQ(0, ringbuf_consume(rb, 12));
+
+    // Serialize straight into the array
+    ASSERT_EQ(10, ringbuf_reserve(rb, 10, spans));
+    EXPECT_EQ(4u, spans[0].len);
+    EXPECT_EQ(6u, spans[1].len);
+    uint8_t value = 0;
+    for (const ringbuf_span &span : spans) {
+        for (size_t i = 0; i < span.len; i++) span.data[i] = value++;
+    }
+    EXPECT_TRUE(ringbuf_empty(rb));
+    // Publish only part of what was reserved
+    EXPECT_EQ(0, ringbuf_commit(rb, 7));
+    EXPECT_EQ(7u, ringbuf_size(rb));
+
+    // Parse in place, releasing a few bytes at a time
+    ASSERT_EQ(7, ringbuf_peek(rb, spans));
+    EXPECT_EQ(4u, spans[0].len);
+    EXPECT_EQ(3u, spans[1].len);
+    EXPECT_EQ(0, spans[0].data[0]);
+    EXPECT_EQ(4, spans[1].data[0]);
+    EXPECT_EQ(0, ringbuf_consume(rb, 5));
+    ASSERT_EQ(2, ringbuf_peek(rb, spans));
+    EXPECT_EQ(5, spans[0].data[0]);
+    EXPECT_EQ(0u, spans[1].len);
+
+    // A reservation is capped at the free space
+    EXPECT_EQ(14, ringbuf_reserve(rb, 100, spans));
+    EXPECT_EQ(14u, spans[0].len + spans[1].len);
+}
+
+TEST_F(RingBufferInstanceTest, CommitAndConsumeBounds) {
+    ringbuf_t *rb = create(8);
+    ringbuf_span spans[2];
+    uint8_t data[8] = {0};
+
+    EXPECT_EQ(-1, ringbuf_consume(rb, 1));
+    EXPECT_EQ(0, ringbuf_consume(rb, 0));
+    EXPECT_EQ(-1, ringbuf_commit(rb, 9));
+    EXPECT_EQ(6, ringbuf_write_to(rb, data, 6));
+    EXPECT_EQ(-1, ringbuf_commit(rb, 3));
+    EXPECT_EQ(0, ringbuf_commit(rb, 2));
+    EXPECT_TRUE(ringbuf_full(rb));
+    EXPECT_EQ(0, ringbuf_reserve(rb, 1, spans));
+    EXPECT_EQ(-1, ringbuf_consume(rb, 9));
+    EXPECT_EQ(0, ringbuf_consume(rb, 8));
+
+    EXPECT_EQ(-1, ringbuf_reserve(nullptr, 1, spans));
+    EXPECT_EQ(-1, ringbuf_reserve(rb, 1, nullptr));
+    EXPECT_EQ(-1, ringbuf_peek(nullptr, spans));
+    EXPECT_EQ(-1, ringbuf_commit(nullptr, 0));
+    EXPECT_EQ(-1, ringbuf_consume(nullptr, 0));
+}
+
+TEST_F(RingBufferInstanceTest, MirroredRegionsNeverSplit) {
+    ringbuf_t *rb = ringbuf_create_mirrored(100);
+    ASSERT_NE(nullptr, rb);
+    buffers.push_back(rb);
+    size_t cap = ringbuf_capacity(rb);
+    EXPECT_EQ(0u, cap % 4096);
+    EXPECT_EQ(0u, cap & (cap - 1));
+
+    // Park both indices 10 bytes before the end of the array
+    std::vector<uint8_t> data(cap), out(cap);
+    EXPECT_EQ((ptrdiff_t)cap - 10, ringbuf_write_to(rb, data.data(), cap - 10));
+    EXPECT_EQ((ptrdiff_t)cap - 10, ringbuf_read_from(rb, out.data(), cap - 10));
+
+    // A whole-capacity reservation still comes back as one span
+    ringbuf_span spans[2];
+    ASSERT_EQ((ptrdiff_t)cap, ringbuf_reserve(rb, cap, spans));
+    EXPECT_EQ(cap, spans[0].len);
+    EXPECT_EQ(0u, spans[1].len);
+    for (size_t i = 0; i < cap; i++) spans[0].data[i] = i * 13 & 0xFF;
+    EXPECT_EQ(0, ringbuf_commit(rb, cap));
+
+    // A record straddling the end reads with plain pointer arithmetic
+    ASSERT_EQ((ptrdiff_t)cap, ringbuf_peek(rb, spans));
+    EXPECT_EQ(cap, spans[0].len);
+    EXPECT_EQ(0u, spans[1].len);
+    uint32_t record;
+    memcpy(&record, spans[0].data + 8, sizeof(record));
+    uint8_t expected[4] = {8 * 13, 9 * 13, 10 * 13, 11 * 13};
+    EXPECT_EQ(0, memcmp(expected, &record, sizeof(record)));
+    EXPECT_EQ(0, ringbuf_consume(rb, 20));
+
+    // Copies see the same bytes across the seam
+    EXPECT_EQ((ptrdiff_t)cap - 20, ringbuf_read_from(rb, out.data(), cap));
+    for (size_t i = 0; i < cap - 20; i++) {
+        ASSERT_EQ((uint8_t)((i + 20) * 13), out[i]) << "byte " << i;
+    }
+    EXPECT_TRUE(ringbuf_empty(rb));
+}
+
+TEST_F(RingBufferInstanceTest, WaitTimesOut) {
+    ringbuf_t *rb = create(16);
+    uint8_t data[16] = {0};
+
+    // Waiting needs blocking mode, chosen before the ring is shared
+    EXPECT_EQ(-1, ringbuf_read_wait(rb, data, sizeof(data), 0));
+    EXPECT_EQ(-1, ringbuf_write_wait(rb, data, sizeof(data), 0));
+    EXPECT_EQ(-1, ringbuf_set_blocking(nullptr));
+    ASSERT_EQ(0, ringbuf_set_blocking(rb));
+
+    auto start = std::chrono::steady_clock::now();
+    EXPECT_EQ(0, ringbuf_read_wait(rb, data, sizeof(data), 20));
+    EXPECT_GE(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(20));
+
+    EXPECT_EQ(16, ringbuf_write_wait(rb, data, sizeof(data), 0));
+    EXPECT_EQ(0, ringbuf_write_wait(rb, data, sizeof(data), 10));
+    EXPECT_EQ(16, ringbuf_read_wait(rb, data, sizeof(data), 0));
+
+    EXPECT_EQ(-1, ringbuf_read_wait(nullptr, data, 1, 0));
+    EXPECT_EQ(-1, ringbuf_write_wait(rb, nullptr, 1, 0));
+}
+
+TEST_F(RingBufferInstanceTest, BlockingProducerConsumer) {
+    ringbuf_t *rb = create(64);
+    ASSERT_NE(nullptr, rb);
+    ASSERT_EQ(0, ringbuf_set_blocking(rb));
+
+    // The producer pauses now and then so the consumer really parks, and the
+    // small buffer makes the producer park whenever the consumer falls behind
+    const size_t total = 1 << 20;
+    std::thread producer([rb, total] {
+        uint8_t chunk[100];
+        size_t sent = 0;
+        while (sent < total) {
+            size_t want = std::min(sizeof(chunk), total - sent);
+            for (size_t i = 0; i < want; i++) chunk[i] = (sent + i) * 3 & 0xFF;
+            ptrdiff_t n = ringbuf_write_wait(rb, chunk, want, -1);
+            ASSERT_GT(n, 0);
+            sent += n;
+            if (sent % 4096 < 100) std::this_thread::sleep_for(std::chrono::microseconds(200));
+        }
+    });
+
+    uint8_t chunk[48];
+    size_t received = 0;
+    bool intact = true;
+    while (received < total) {
+        ptrdiff_t n = ringbuf_read_wait(rb, chunk, sizeof(chunk), 5000);
+        ASSERT_GT(n, 0) << "timed out at byte " << received;
+        for (ptrdiff_t i = 0; i < n; i++) intact &= chunk[i] == (uint8_t)((received + i) * 3);
+        received += n;
+    }
+    producer.join();
+    EXPECT_TRUE(intact);
+}
+
+TEST_F(RingBufferInstanceTest, EventfdSignalsOnceArmed) {
+    ringbuf_t *rb = create(16);
+    int rfd = ringbuf_readable_fd(rb);
+    int wfd = ringbuf_writable_fd(rb);
+    ASSERT_GE(rfd, 0);
+    ASSERT_GE(wfd, 0);
+    EXPECT_EQ(rfd, ringbuf_readable_fd(rb));
+
+    auto ready = [](int fd) {
+        struct pollfd p = {fd, POLLIN, 0};
+        return poll(&p, 1, 0) == 1;
+    };
+    auto drain = [](int fd) {
+        uint64_t count;
+        return read(fd, &count, sizeof(count)) == (ssize_t)sizeof(count);
+    };
+
+    uint8_t data[16] = {0}, out[16];
+    EXPECT_FALSE(ready(rfd));
+    // Coming up empty arms the fd, the next write signals it
+    EXPECT_EQ(0, ringbuf_read_from(rb, out, sizeof(out)));
+    EXPECT_EQ(4, ringbuf_write_to(rb, data, 4));
+    EXPECT_TRUE(ready(rfd));
+    EXPECT_TRUE(drain(rfd));
+    // Only the first write after arming costs a signal
+    EXPECT_EQ(4, ringbuf_write_to(rb, data, 4));
+    EXPECT_FALSE(ready(rfd));
+
+    // Same for room: fill up, come up short, then a read signals
+    EXPECT_EQ(8, ringbuf_write_to(rb, data, sizeof(data)));
+    EXPECT_EQ(0, ringbuf_write_to(rb, data, sizeof(data)));
+    EXPECT_FALSE(ready(wfd));
+    EXPECT_EQ(16, ringbuf_read_from(rb, out, sizeof(out)));
+    EXPECT_TRUE(ready(wfd));
+    EXPECT_TRUE(drain(wfd));
+
+    // Peek re-arms the readable side as well
+    ringbuf_span spans[2];
+    EXPECT_EQ(0, ringbuf_peek(rb, spans));
+    ASSERT_EQ(1, ringbuf_reserve(rb, 1, spans));
+    EXPECT_EQ(0, ringbuf_commit(rb, 1));
+    EXPECT_TRUE(ready(rfd));
+}
+
+class RingBufferMpmcTest : public ::testing::Test {
+protected:
+    void TearDown() override {
+        ringbuf_mpmc_destroy(q);
+    }
+
+    ringbuf_mpmc_t *q = nullptr;
+};
+
+TEST_F(RingBufferMpmcTest, FifoUntilFull) {
+    q = ringbuf_mpmc_create(6, sizeof(uint64_t));
+    ASSERT_NE(nullptr, q);
+    EXPECT_EQ(8u, ringbuf_mpmc_capacity(q));
+    EXPECT_EQ(sizeof(uint64_t), ringbuf_mpmc_elem_size(q));
+
+    uint64_t value = 0;
+    EXPECT_EQ(0, ringbuf_mpmc_try_dequeue(q, &value));
+
+    // Several laps around the slots, filling and draining each time
+    for (uint64_t lap = 0; lap < 3; lap++) {
+        for (uint64_t i = 0; i < 8; i++) {
+            value = lap * 100 + i;
+            EXPECT_EQ(1, ringbuf_mpmc_try_enqueue(q, &value));
+        }
+        EXPECT_EQ(0, ringbuf_mpmc_try_enqueue(q, &value));
+        for (uint64_t i = 0; i < 8; i++) {
+            EXPECT_EQ(1, ringbuf_mpmc_try_dequeue(q, &value));
+            EXPECT_EQ(lap * 100 + i, value);
+        }
+        EXPECT_EQ(0, ringbuf_mpmc_try_dequeue(q, &value));
+    }
+}
+
+TEST_F(RingBufferMpmcTest, OddSizedElements) {
+    struct record { char name[13]; };
+    q = ringbuf_mpmc_create(4, sizeof(record));
+    ASSERT_NE(nullptr, q);
+
+    record in[3] = {{"alpha"}, {"beta"}, {"gamma"}}, out;
+    for (const record &r : in) EXPECT_EQ(1, ringbuf_mpmc_enqueue(q, &r));
+    for (const record &r : in) {
+        EXPECT_EQ(1, ringbuf_mpmc_dequeue(q, &out));
+        EXPECT_STREQ(r.name, out.name);
+    }
+}
+
+TEST_F(RingBufferMpmcTest, InvalidArguments) {
+    EXPECT_EQ(nullptr, ringbuf_mpmc_create(0, 8));
+    EXPECT_EQ(nullptr, ringbuf_mpmc_create(8, 0));
+    q = ringbuf_mpmc_create(8, 8);
+    uint64_t value = 0;
+    EXPECT_EQ(-1, ringbuf_mpmc_try_enqueue(nullptr, &value));
+    EXPECT_EQ(-1, ringbuf_mpmc_try_dequeue(nullptr, &value));
+    EXPECT_EQ(-1, ringbuf_mpmc_enqueue(q, nullptr));
+    EXPECT_EQ(-1, ringbuf_mpmc_dequeue(q, nullptr));
+    ringbuf_mpmc_destroy(nullptr);
+}
+
+TEST_F(RingBufferMpmcTest, ManyProducersManyConsumers) {
+    q = ringbuf_mpmc_create(64, sizeof(uint64_t));
+    ASSERT_NE(nullptr, q);
+
+    // Each producer tags its values with its index, so the consumers can check
+    // that every value arrives exactly once and each producer's stay in order
+    const int producers = 4, consumers = 4;
+    const uint64_t per_producer = 200000;
+    std::atomic<uint64_t> remaining(producers * per_producer);
+    std::vector<std::vector<uint64_t>> seen(consumers);
+
+    std::vector<std::thread> threads;
+    for (int p = 0; p < producers; p++) {
+        threads.emplace_back([this, p, per_producer] {
+            for (uint64_t i = 0; i < per_producer; i++) {
+                uint64_t value = (uint64_t)p << 32 | i;
+                ringbuf_mpmc_enqueue(q, &value);
+            }
+        });
+    }
+    for (int c = 0; c < consumers; c++) {
+        threads.emplace_back([this, c, &remaining, &seen] {
+            uint64_t value;
+            while (remaining.load() > 0) {
+                if (ringbuf_mpmc_try_dequeue(q, &value) == 1) {
+                    seen[c].push_back(value);
+                    remaining--;
+                } else {
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+    for (std::thread &t : threads) t.join();
+
+    std::vector<uint64_t> count(producers);
+    for (const std::vector<uint64_t> &values : seen) {
+        std::vector<int64_t> last(producers, -1);
+        for (uint64_t value : values) {
+            int p = value >> 32;
+            int64_t i = value & 0xFFFFFFFF;
+            ASSERT_LT(p, producers);
+            ASSERT_GT(i, last[p]) << "producer " << p << " reordered";
+            last[p] = i;
+            count[p]++;
+        }
+    }
+    for (int p = 0; p < producers; p++) EXPECT_EQ(per_producer, count[p]);
+    uint64_t value;
+    EXPECT_EQ(0, ringbuf_mpmc_try_dequeue(q, &value));
+}
@@ -0,0 +1,189 @@
+#include <gtest/gtest.h>
+#include <stdint.h>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ring_queue.hpp"
+
+struct Record {
+    uint32_t id;
+    double value;
+    char tag[8];
+};
+
+// Counts live instances, and throws from a move once moves_left runs out
+struct ThrowingMove {
+    static int live;
+    static int moves_left;
+    int value;
+
+    ThrowingMove(int v = 0) : value(v) { live++; }
+    ThrowingMove(ThrowingMove &&other) : value(other.value) {
+        count_move();
+        live++;
+    }
+    ThrowingMove &operator=(ThrowingMove &&other) {
+        count_move();
+        value = other.value;
+        return *this;
+    }
+    ~ThrowingMove() { live--; }
+
+    static void count_move() {
+        if (moves_left == 0) {
+            moves_left = -1;
+            throw std::runtime_error("move failed");
+        }
+        if (moves_left > 0) moves_left--;
+    }
+};
+int ThrowingMove::live = 0;
+int ThrowingMove::moves_left = -1;
+
+TEST(RingQueueTest, InitialStateEmpty) {
+    RingQueue<Record, 8> q;
+    EXPECT_TRUE(q.empty());
+    EXPECT_FALSE(q.full());
+    EXPECT_EQ(0u, q.size());
+    EXPECT_EQ(8u, q.capacity());
+    EXPECT_FALSE(q.try_pop().has_value());
+}
+
+TEST(RingQueueTest, FifoAcrossLaps) {
+    RingQueue<Record, 4> q;
+    for (uint32_t lap = 0; lap < 5; lap++) {
+        for (uint32_t i = 0; i < 4; i++) {
+            EXPECT_TRUE(q.try_push(Record{lap * 10 + i, i * 0.5, "rec"}));
+        }
+        EXPECT_TRUE(q.full());
+        EXPECT_FALSE(q.try_push(Record{99, 0, "x"}));
+        for (uint32_t i = 0; i < 4; i++) {
+            std::optional<Record> r = q.try_pop();
+            ASSERT_TRUE(r.has_value());
+            EXPECT_EQ(lap * 10 + i, r->id);
+            EXPECT_EQ(i * 0.5, r->value);
+            EXPECT_STREQ("rec", r->tag);
+        }
+        EXPECT_TRUE(q.empty());
+    }
+}
+
+TEST(RingQueueTest, MoveOnlyElements) {
+    RingQueue<std::unique_ptr<int>, 4> q;
+    EXPECT_TRUE(q.try_emplace(new int(1)));
+    EXPECT_TRUE(q.try_push(std::make_unique<int>(2)));
+    std::unique_ptr<int> p = std::make_unique<int>(3);
+    EXPECT_TRUE(q.try_push(std::move(p)));
+    EXPECT_EQ(nullptr, p);
+
+    std::unique_ptr<int> out;
+    ASSERT_TRUE(q.try_pop(out));
+    EXPECT_EQ(1, *out);
+    std::optional<std::unique_ptr<int>> next = q.try_pop();
+    ASSERT_TRUE(next.has_value());
+    EXPECT_EQ(2, **next);
+    // The last one is left for the destructor to release
+    EXPECT_EQ(1u, q.size());
+}
+
+TEST(RingQueueTest, DestructorReleasesQueuedElements) {
+    std::shared_ptr<int> shared = std::make_shared<int>(7);
+    {
+        RingQueue<std::shared_ptr<int>, 8> q;
+        for (int i = 0; i < 5; i++) q.try_push(shared);
+        q.try_pop();
+        EXPECT_EQ(5, shared.use_count());
+    }
+    EXPECT_EQ(1, shared.use_count());
+}
+
+TEST(RingQueueTest, BatchPushAndPop) {
+    RingQueue<std::string, 16> q;
+    std::vector<std::string> in, out(16);
+    for (int i = 0; i < 20; i++) in.push_back("item " + std::to_string(i));
+
+    // Park the indices near the end so the batch wraps
+    for (int i = 0; i < 12; i++) q.try_emplace("filler");
+    EXPECT_EQ(12u, q.pop_n(out.data(), 12));
+
+    // Only 16 fit; the rest stay with the caller untouched
+    EXPECT_EQ(16u, q.push_n(in.data(), in.size()));
+    EXPECT_TRUE(q.full());
+    EXPECT_EQ("item 16", in[16]);
+
+    EXPECT_EQ(10u, q.pop_n(out.data(), 10));
+    EXPECT_EQ(6u, q.pop_n(out.data() + 10, 10));
+    for (int i = 0; i < 16; i++) EXPECT_EQ("item " + std::to_string(i), out[i]);
+    EXPECT_EQ(0u, q.pop_n(out.data(), 1));
+}
+
+TEST(RingQueueTest, BatchKeepsWhatMovedBeforeAThrow) {
+    {
+        RingQueue<ThrowingMove, 8> q;
+        std::vector<ThrowingMove> in, out(8);
+        in.reserve(8);
+        for (int i = 0; i < 8; i++) in.emplace_back(i);
+        EXPECT_EQ(16, ThrowingMove::live);
+
+        // The fourth move throws; the three before it are queued
+        ThrowingMove::moves_left = 3;
+        EXPECT_THROW(q.push_n(in.data(), 8), std::runtime_error);
+        EXPECT_EQ(3u, q.size());
+        EXPECT_EQ(19, ThrowingMove::live);
+
+        // The second assignment throws; the first element is taken, the second stays
+        ThrowingMove::moves_left = 1;
+        EXPECT_THROW(q.pop_n(out.data(), 3), std::runtime_error);
+        EXPECT_EQ(2u, q.size());
+        EXPECT_EQ(18, ThrowingMove::live);
+
+        EXPECT_EQ(2u, q.pop_n(out.data() + 1, 8));
+        for (int i = 0; i < 3; i++) EXPECT_EQ(i, out[i].value);
+        EXPECT_TRUE(q.empty());
+        EXPECT_EQ(16, ThrowingMove::live);
+    }
+    // Every element was destroyed exactly once
+    EXPECT_EQ(0, ThrowingMove::live);
+}
+
+TEST(RingQueueTest, ProducerConsumerThreads) {
+    auto q = std::make_unique<RingQueue<uint64_t, 256>>();
+    const uint64_t total = 4 << 20;
+
+    std::thread producer([&q, total] {
+        uint64_t batch[37];
+        uint64_t sent = 0;
+        while (sent < total) {
+            size_t want = std::min<uint64_t>(37, total - sent);
+            for (size_t i = 0; i < want; i++) batch[i] = sent + i;
+            size_t n = q->push_n(batch, want);
+            if (n == 0) std::this_thread::yield();
+            sent += n;
+        }
+    });
+
+    uint64_t received = 0;
+    bool in_order = true;
+    while (received < total) {
+        uint64_t value;
+        if (received % 2 == 0) {
+            if (!q->try_pop(value)) {
+                std::this_thread::yield();
+                continue;
+            }
+            in_order &= value == received++;
+        } else {
+            uint64_t batch[50];
+            size_t n = q->pop_n(batch, 50);
+            if (n == 0) std::this_thread::yield();
+            for (size_t i = 0; i < n; i++) in_order &= batch[i] == received++;
+        }
+    }
+    producer.join();
+
+    EXPECT_TRUE(in_order);
+    EXPECT_TRUE(q->empty());
+}